@@ -0,0 +1,54 @@
+#define _GNU_SOURCE
+/*-----------------------------------------------------------------------------
+		include files
+------------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "alarm.h"
+#include "gwconfig.h"
+
+/*------------------------------------------------------------------------------
+		implementation code
+------------------------------------------------------------------------------*/
+/* the state 'value' belongs to, seen from 'current': leaving hot or cold needs the extra hysteresis margin */
+static alarm_state_t classify(alarm_state_t current, sensor_value_t value, double min, double max){
+  const double h = gw_config.alarm_hysteresis;
+  switch(current){
+    case ALARM_HOT:
+      if(value < min)return ALARM_COLD;
+      return value < max - h ? ALARM_NORMAL : ALARM_HOT;
+    case ALARM_COLD:
+      if(value > max)return ALARM_HOT;
+      return value > min + h ? ALARM_NORMAL : ALARM_COLD;
+    default:
+      if(value > max)return ALARM_HOT;
+      return value < min ? ALARM_COLD : ALARM_NORMAL;
+  }
+}
+
+bool alarm_update(alarm_t * alarm, sensor_value_t value, sensor_ts_t ts, double min, double max, alarm_state_t * report){
+  alarm_state_t next = classify(alarm->state, value, min, max);
+
+  if(next == alarm->state){
+    /* a short excursion that didn't last the dwell time is forgotten */
+    alarm->pending = alarm->state;
+    if(alarm->state != ALARM_NORMAL && gw_config.alarm_reminder > 0 && ts - alarm->last_report >= gw_config.alarm_reminder){
+      alarm->last_report = ts;
+      *report = alarm->state;
+      return true;
+    }
+    return false;
+  }
+
+  if(next != alarm->pending){
+    alarm->pending = next;
+    alarm->pending_since = ts;
+  }
+  if(ts - alarm->pending_since < gw_config.alarm_dwell)return false;
+
+  alarm->state = next;
+  alarm->last_report = ts;
+  *report = next;
+  return true;
+}
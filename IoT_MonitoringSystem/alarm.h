@@ -0,0 +1,43 @@
+#ifndef _ALARM_H_
+#define _ALARM_H_
+
+#include <stdbool.h>
+#include "config.h"
+
+#ifndef ALARM_HYSTERESIS
+  #define ALARM_HYSTERESIS 0.5        // an alarm clears this far inside the threshold, default of gw_config.alarm_hysteresis
+#endif
+
+#ifndef ALARM_DWELL
+  #define ALARM_DWELL 0               // seconds a new state must hold before it is reported, default of gw_config.alarm_dwell
+#endif
+
+#ifndef ALARM_REMINDER
+  #define ALARM_REMINDER 0            // seconds between repeats of an active alarm, 0 = never, default of gw_config.alarm_reminder
+#endif
+
+typedef enum{
+  ALARM_NORMAL = 0,
+  ALARM_HOT,
+  ALARM_COLD
+}alarm_state_t;
+
+/*
+ * Alarm state of one sensor or room, zero initialised means normal
+ * Times are sensor timestamps, so dwell and reminders follow the readings, not the gateway clock
+ */
+typedef struct{
+  alarm_state_t     state;
+  alarm_state_t     pending;              // state the value moved to, reported once it held for the dwell time
+  sensor_ts_t         pending_since;
+  sensor_ts_t         last_report;
+}alarm_t;
+
+/*
+ * Feeds a new average 'value' at time 'ts' to 'alarm', with thresholds 'min' and 'max'
+ * and the hysteresis, dwell and reminder times of gw_config
+ * Returns the state to report (a transition or a reminder) in '*report' and true, or false if nothing is to be reported
+ */
+bool alarm_update(alarm_t * alarm, sensor_value_t value, sensor_ts_t ts, double min, double max, alarm_state_t * report);
+
+#endif /* _ALARM_H_ */
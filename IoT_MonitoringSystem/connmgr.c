@@ -13,27 +13,27 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <semaphore.h>
+#include <errno.h>
+#include <stdatomic.h>
 
 #include "lib/tcpsock.h"
 #include "lib/dplist.h"
 #include "config.h"
 #include "errmacros.h"
 #include "sbuffer.h"
-
-#ifndef  TIMEOUT
-  #error "undefined TIMEOUT"
-#endif
+#include "logevent.h"
+#include "gwconfig.h"
+#include "dedup.h"
 
 /*------------------------------------------------------------------------------
 		global variable declarations
 ------------------------------------------------------------------------------*/
-extern sem_t fifo_sem;
-extern FILE *fp;
-
 int       dplist_errno;
 static  dplist_t * client_list = NULL;
 static  struct pollfd * pollfd_ptr = NULL;
 static  sbuffer_data_t * data_temp = NULL;
+static  dedup_t * dedup = NULL;                  // retransmit filter, NULL when gw_config.dedup_horizon is 0
+static  atomic_long duplicates = 0;
 
 /*------------------------------------------------------------------------------
 		definitions (defines, typedefs, ...)
@@ -43,6 +43,7 @@ typedef struct{
   tcpsock_t *      sock_ptr;
   sensor_data_t data;
   bool                 if_log_to_fifo;
+  long                 duplicates;        // readings of this connection dropped by the retransmit filter
 }socket_node;
 
 /*------------------------------------------------------------------------------
@@ -55,7 +56,6 @@ void           connmgr_element_free        (void ** element);	// If needed, free
 int             connmgr_element_compare (void * x, void * y);  // Compare two element elements; returns -1 if x<y, 0 if x==y, or 1 if x>y 
 tcpsock_t * get_socket_by_fd                 (dplist_t * list, int fd);
 void *         get_client_by_fd                  (dplist_t * list, int fd);
-void            log_to_fifo                           ( char * buf, sem_t sema, FILE * fp_t );
 void            connmgr_free();
 
 /*------------------------------------------------------------------------------
@@ -69,7 +69,6 @@ void connmgr_listen(int port_number, sbuffer_t ** buffer){
   double       time_out;
   sensor_data_t data;
   time_t         current_time;
-  char *         send_buf; 
   
 #ifdef DEBUG
   FILE * fp_text;
@@ -90,6 +89,8 @@ void connmgr_listen(int port_number, sbuffer_t ** buffer){
   client_list = dpl_create(&connmgr_element_copy, &connmgr_element_free, &connmgr_element_compare);
   assert(client_list != NULL);
   
+  if(gw_config.dedup_horizon > 0)dedup = dedup_create(gw_config.dedup_horizon);
+  
   printf("the main server is started\n");
   if (tcp_passive_open(&server,port_number)!=TCP_NO_ERROR) exit(EXIT_FAILURE);
   socket_alive++;
@@ -98,7 +99,8 @@ void connmgr_listen(int port_number, sbuffer_t ** buffer){
   pollfd_ptr->events = POLLIN;
   
   while(socket_alive){
-    int result = poll( pollfd_ptr, socket_alive, TIMEOUT * 1000); 
+    int result = poll( pollfd_ptr, socket_alive, gw_config.timeout * 1000); 
+    if(result == -1 && errno == EINTR)continue;                    // SIGHUP asks datamgr to reload the sensor map
     SYSCALL_ERROR( result );                                                      
     
     if(result == 0){
@@ -127,6 +129,7 @@ void connmgr_listen(int port_number, sbuffer_t ** buffer){
       ((socket_node *)socket_node_ptr)->data.value = 0;
       ((socket_node *)socket_node_ptr)->data.ts = 0;
       ((socket_node *)socket_node_ptr)->if_log_to_fifo = 0;
+      ((socket_node *)socket_node_ptr)->duplicates = 0;
       
       client_list = dpl_insert_at_index( client_list, socket_node_ptr, dpl_size(client_list), true);
       free(socket_node_ptr);
@@ -164,7 +167,12 @@ void connmgr_listen(int port_number, sbuffer_t ** buffer){
 	  data_temp->sensor_data.value = data.value;
 	  data_temp->sensor_data.ts = data.ts;
 	  
-	  if( sbuffer_insert( *buffer, data_temp) == SBUFFER_FAILURE){
+	  /* sensors resend their last readings after a reconnect, those are neither stored nor aggregated again */
+	  if(dedup != NULL && dedup_seen(dedup, &data)){
+	    node_ptr_t->duplicates++;
+	    atomic_fetch_add(&duplicates, 1);
+	  }
+	  else if( sbuffer_insert( *buffer, data_temp) == SBUFFER_FAILURE){
             printf("writer thread insertion failure!\n");
 	    exit(EXIT_FAILURE);
           }
@@ -181,22 +189,19 @@ void connmgr_listen(int port_number, sbuffer_t ** buffer){
 	  
 	  if( node_ptr_t->if_log_to_fifo == 0 ){
 	    //write output to FIFO
-	    ASPRINTF_ERROR(asprintf( &send_buf, "A sensor node with %" PRIu16 " has opened a new connection\n", node_ptr_t->data.id));
-	    
-            log_to_fifo( send_buf, fifo_sem, fp );
+	    log_event( LOG_EV_CONN_OPEN, node_ptr_t->data.id, 0 );
 	    node_ptr_t->if_log_to_fifo = 1;
 	  }
 	}
 	
 	time(&current_time);
 	time_out = difftime(current_time, node_ptr_t->data.ts);
-	if(time_out >= (double)TIMEOUT ){
+	if(time_out >= (double)gw_config.timeout ){
 	  if (tcp_close( &temp)!=TCP_NO_ERROR) exit(EXIT_FAILURE);
 	  
 	  //write output to FIFO
-	  ASPRINTF_ERROR(asprintf( &send_buf, "A sensor node with %" PRIu16 " has closed the connection\n", node_ptr_t->data.id));
-	  
-	  log_to_fifo( send_buf, fifo_sem, fp );
+	  if(node_ptr_t->duplicates != 0)log_event( LOG_EV_DUPLICATES_DROPPED, node_ptr_t->data.id, node_ptr_t->duplicates );
+	  log_event( LOG_EV_CONN_CLOSE, node_ptr_t->data.id, 0 );
 	  
 	  client_list = dpl_remove_element( client_list, node_ptr_t, true );
 #ifdef DEBUG
@@ -211,6 +216,7 @@ void connmgr_listen(int port_number, sbuffer_t ** buffer){
     }
   }
   if (tcp_close( &server )!=TCP_NO_ERROR) exit(EXIT_FAILURE);
+  DEBUG_PRINT("connmgr dropped %ld duplicate readings\n", atomic_load(&duplicates));
 #ifdef DEBUG
     fclose(fp_text);
 #endif
@@ -220,6 +226,11 @@ void connmgr_free(){
   free(pollfd_ptr);
   free(data_temp);
   dpl_free(&client_list);
+  dedup_free(&dedup);
+}
+
+long connmgr_get_duplicates(void){
+  return atomic_load(&duplicates);
 }
 
 tcpsock_t * get_socket_by_fd(dplist_t * list, int fd){
@@ -244,25 +255,6 @@ void * get_client_by_fd(dplist_t * list, int fd){
   return NULL;
 }
 
-/* write log_event to fifo */
-void log_to_fifo( char * buf, sem_t sema, FILE * fp_t ){
-  int presult;	  
-  presult = sem_wait( &sema );
-  ERROR_HANDLER(presult);
-  
-  if ( fputs( buf, fp_t ) == EOF )
-  {
-    fprintf( stderr, "Error writing data to fifo.\n");
-    exit( EXIT_FAILURE );
-  } 
-  FFLUSH_ERROR(fflush(fp_t));
-  DEBUG_PRINT("Message send to fifo: %s\n", buf);
-  free( buf );
-  
-  presult = sem_post( &sema );
-  ERROR_HANDLER(presult);
-}
-
 void dpl_print( dplist_t * list )
 {
   int i, length;
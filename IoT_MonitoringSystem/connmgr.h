@@ -3,6 +3,13 @@
 
 #include "sbuffer.h"
 
+/*
+ * Compile time default, the value in use is gw_config.timeout (DEDUP_HORIZON in dedup.h is gw_config.dedup_horizon)
+ */
+#ifndef TIMEOUT
+  #define TIMEOUT 5
+#endif
+
 /*
  * This method starts listening on the given port and when when a sensor node connects it 
  * stores the sensor data in the shared buffer.
@@ -15,5 +22,11 @@ void connmgr_listen(int port_number, sbuffer_t ** buffer);
  */
 void connmgr_free();
 
+/*
+ * Returns the number of retransmitted readings dropped since connmgr started (see gw_config.dedup_horizon)
+ * Safe from any thread
+ */
+long connmgr_get_duplicates(void);
+
 #endif /* CONNMGR_H */
 
@@ -12,127 +12,469 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <semaphore.h>
-#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <math.h>
 
-#include "lib/dplist.h"
 #include "datamgr.h"
 #include "errmacros.h"
 #include "connmgr.h"
 #include "sbuffer.h"
+#include "logevent.h"
+#include "gwconfig.h"
+#include "rollup.h"
+#include "alarm.h"
+#include "mapfile.h"
+#include "timerwheel.h"
 
-/*------------------------------------------------------------------------------
-		global variable declarations
-------------------------------------------------------------------------------*/
-extern sem_t                fifo_sem;
-extern FILE *               fp;
-extern sbuffer_t *        sec_buffer;
-static   dplist_t *          sensor_avg_list = NULL;
-int        dplist_errno;
-
-extern void                  log_to_fifo( char * buf, sem_t sema, FILE * fp_t );
-extern void                  sbuffer_print(sbuffer_t * ptr);
 /*------------------------------------------------------------------------------
 		definitions (defines, typedefs, ...)
 ------------------------------------------------------------------------------*/
+#define SENSOR_ID_RANGE   (UINT16_MAX + 1)      // sensor_id_t is 16 bit, so the index covers every possible id
+#define NO_SLOT               0                         // index value of an unmapped sensor id, slots are stored + 1
+#define RELOAD_POLL_MS     1000                 // how often the reload thread checks for SIGHUP
+#define FLEET_SWEEP_INTERVAL 1                // seconds between sweeps of a worker's shard
+#define TIME_MAX            ((sensor_ts_t)INT64_MAX)
+
+/* every sensor of a worker has two timers in the worker's wheel: 2 * (sensor id / workers) + WATCH_* */
+#define WATCH_SILENCE      0
+#define WATCH_FLATLINE     1
+#define WATCH_KINDS          2
+
+/*
+ * The running sum is updated with (new - oldest) on every reading, which slowly accumulates rounding error
+ * Every RESUM_PERIOD readings (and at least once per window) it is recomputed with compensated summation
+ */
+#ifndef RESUM_PERIOD
+  #define RESUM_PERIOD 1024
+#endif
+
+#define SNAPSHOT_WORDS    ((sizeof(datamgr_sensor_t) + sizeof(uint64_t) - 1) / sizeof(uint64_t))
+
+/*
+ * Monotonic deque over the last run_avg_length readings (a ring of that capacity)
+ * The front holds the minimum (or maximum) of the window, dominated readings are dropped from the back
+ */
+typedef struct{
+  sensor_value_t   value;
+  uint32_t              seq;
+}deque_entry_t;
+
+typedef struct{
+  deque_entry_t *   items;                 // gw_config.run_avg_length entries behind the sensor node
+  int                       head;
+  int                       count;
+}minmax_deque_t;
+
+/*
+ * Reorder stage (gw_config.reorder_depth > 0): a min-heap on timestamp of the readings held back,
+ * ties keep their arrival order
+ */
+typedef struct{
+  sensor_ts_t         ts;
+  sensor_value_t   value;
+  uint32_t              order;
+}held_reading_t;
+
+/*
+ * Time based window (gw_config.window_seconds > 0): a ring with one partial sum per second of sensor time
+ * Bucket ts % window_seconds holds the readings of second ts, buckets of seconds that fell out of the window
+ * are subtracted from the totals when the window moves past them, O(1) amortised per reading
+ */
+typedef struct{
+  sensor_ts_t         second;
+  double                  sum;
+  uint32_t              count;
+}time_bucket_t;
+
+/*
+ * Statistics of one sensor, allocated in one block together with its window, deques and buckets
+ * A node survives map reloads for as long as its sensor stays in the map
+ */
 typedef struct{
   sensor_id_t         sensor_id;
-  sensor_id_t         room_id;
   sensor_value_t   running_avg;
   sensor_ts_t         timestamp;
+  bool                    avg_ready;           // running_avg holds the average of a full window
+  atomic_uint           snapshot_seq;     // seqlock of 'snapshot', odd while the owning worker writes it
+  atomic_uint_fast64_t  snapshot[SNAPSHOT_WORDS];  // datamgr_sensor_t for readers in other threads
+  alarm_t                alarm;
+  uint32_t              rollup_gen;          // generation of the map whose rollups hold running_avg, 0 = none
   
-  sensor_value_t    buf[RUN_AVG_LENGTH];
-  int                       buf_size;
+  /* reorder stage, readings are aggregated in timestamp order */
+  held_reading_t *  held;                   // gw_config.reorder_depth + 1 entries
+  int                       held_count;
+  uint32_t              held_order;
+  sensor_ts_t         held_newest;        // latest timestamp admitted
+  time_t                  held_heard;         // wall clock arrival of the latest reading admitted
+  uint32_t              late;                    // readings older than one already aggregated, stored but not aggregated
+  
+  /* silence and flatline watch, wall clock times of arrival */
+  time_t                  heard;                 // last reading, 0 if none yet
+  time_t                  changed;             // first reading of the current value
+  sensor_value_t   stuck_value;
+  bool                    silent;
+  bool                    stuck;
+  
+  int                       buf_size;             // readings in the window, up to gw_config.run_avg_length
+  int                       head;                  // slot of the oldest reading, overwritten by the next one
+  int                       since_resum;       // readings since the sum was last recomputed
+  double                  sum;                   // sum of the buf_size readings in the window
+  sensor_value_t *  buf;                   // circular window of gw_config.run_avg_length values
+  
+  /* aggregates, see AGG_* in datamgr.h */
+  uint32_t              seq;                    // readings so far
+  sensor_value_t   ewma;
+  double                  mean;                 // Welford mean and sum of squared deviations over the window
+  double                  m2;
+  sensor_value_t   last_value;
+  sensor_value_t   rate;                   // per second
+  minmax_deque_t  min_q;
+  minmax_deque_t  max_q;
+  
+  /* time based window */
+  time_bucket_t *    buckets;              // gw_config.window_seconds buckets
+  sensor_ts_t         first_ts;
+  sensor_ts_t         newest;               // latest second seen, the window is (newest - window_seconds, newest]
+  double                  time_sum;
+  uint32_t              time_count;
 }sensor_node_t;
 
+/*
+ * What the sensor map says about one sensor
+ */
+typedef struct{
+  sensor_node_t *   node;
+  sensor_id_t         room_id;
+  uint32_t              rollup[ROLLUP_LEVELS];   // room, floor and building slot, ROLLUP_NONE if not mapped
+  bool                    seeded;               // the node's running average was already in the rollups when they were built
+  sensor_value_t   seed;                   // ... with this value
+  uint32_t              shard_slot;         // slot in the columns of the owning worker's shard
+  int                       silence_after;      // silence and flatline timeouts of the sensor's room, 0 = not watched
+  int                       flatline_after;
+}map_entry_t;
+
+/*
+ * The state fleet sweeps look at, for the sensors of one worker, as a structure of arrays indexed by shard slot
+ * Only the owning worker writes and scans it, so a sweep is a linear pass over a few dense columns
+ */
+typedef struct{
+  int                       count;
+  uint32_t *             entry;                 // shard slot -> entry slot
+  sensor_value_t *  avg;                    // running average, NAN until the window is full
+  sensor_ts_t *        last_seen;           // timestamp of the last reading, 0 if none yet
+}map_shard_t;
+
+/*
+ * One version of the sensor map, immutable once published in current_map
+ * A reload builds a new version next to the old one, reusing the nodes of the sensors it keeps,
+ * swaps the pointer and frees the old version when no thread can still be using it (RCU style)
+ */
+typedef struct{
+  uint32_t              generation;
+  int                       count;
+  map_entry_t *      entries;               // in map file order
+  uint32_t *             index;                 // sensor id -> entry slot + 1, NO_SLOT if not mapped
+  rollup_set_t *      rollups;
+  int                       shard_count;       // gw_config.datamgr_workers, sensor id % shard_count picks the shard
+  map_shard_t *      shards;
+}sensor_map_t;
+
+/* what a worker's last sweep found in its shard, combined by datamgr_get_fleet */
+typedef struct{
+  int                       sensors;
+  int                       ready;
+  int                       above_max;
+  int                       below_min;
+  double                  sum;
+  sensor_value_t   min;
+  sensor_value_t   max;
+  sensor_ts_t         oldest;
+  sensor_ts_t         newest;
+}fleet_partial_t;
+
+#define FLEET_WORDS    ((sizeof(fleet_partial_t) + sizeof(uint64_t) - 1) / sizeof(uint64_t))
+#define SWEEP_LANES     4              // independent accumulators, so the sweep loops map onto SIMD registers
+
+/*
+ * A sensor that is not in the map, tracked with gw_config.provisional_sensors > 0
+ * Provisional sensors have no room, they are kept in least recently used order and the oldest one is
+ * dropped when the table is full. A map reload that adds the sensor takes its node over (promotes it)
+ */
+typedef struct provisional{
+  sensor_node_t *      node;
+  bool                     promoted;           // the node belongs to the next map version, don't free it
+  struct provisional * newer;
+  struct provisional * older;
+}provisional_t;
+
+/* provisional sensors of one worker, the lock is only contended while a reload promotes sensors */
+typedef struct{
+  pthread_mutex_t    lock;
+  provisional_t *      newest;
+  provisional_t *      oldest;
+  int                       count;
+  int                       capacity;
+}provisional_table_t;
+
+/*
+ * Readings are processed by gw_config.datamgr_workers threads, sensor id % workers picks the worker,
+ * so the per-sensor state is never shared and a sensor keeps its worker across map reloads
+ */
+typedef struct{
+  pthread_t            thread;
+  sbuffer_t *           queue;                // readings of this worker's sensors, in arrival order
+  int                       index;
+  long                     processed;
+  atomic_uint_fast64_t  quiescent;      // odd while a reading is processed, the reloader waits for it to move on
+  provisional_table_t provisional;
+  
+  /* fleet sweep, at most once per FLEET_SWEEP_INTERVAL and only after something changed */
+  bool                    dirty;
+  uint32_t              swept_generation;
+  time_t                  next_sweep;
+  atomic_uint           fleet_seq;
+  atomic_uint_fast64_t  fleet[FLEET_WORDS];     // fleet_partial_t of the last sweep
+  
+  timer_wheel_t *   watch;                 // silence and flatline timers of the worker's sensors, NULL if none is watched
+}datamgr_worker_t;
+
 /*------------------------------------------------------------------------------
-		function declarations
+		global variable declarations
 ------------------------------------------------------------------------------*/
-void      datamgr_dpl_print             (dplist_t * list);
-void *   datamgr_element_copy      (void * element); 	// Duplicate 'element'; If needed allocated new memory for the duplicated element.
-void      datamgr_element_free       (void ** element);	// If needed, free memory allocated to element
-int        datamgr_element_compare(void * x, void * y);  // Compare two element elements; returns -1 if x<y, 0 if x==y, or 1 if x>y 
+extern sbuffer_t *        sec_buffer;
 
-sensor_node_t * search_list             (sensor_id_t sensor_id);  //search sensor data in the list
-void                   read_sensor_map   (FILE * fp_sensor_map); //read_sensor_map
+static   _Atomic(sensor_map_t *) current_map = NULL;
+static   atomic_int                map_readers = 0;          // accessor calls (datamgr_get_*) using current_map
+static   datamgr_worker_t *  pool = NULL;
+static   atomic_int                pool_size = 0;            // set once the pool and provisional_index are ready
+static   provisional_t **       provisional_index = NULL; // sensor id -> provisional sensor, under the owning worker's lock
+
+static   atomic_long              late_readings = 0;        // of all sensors, see datamgr_get_fleet
+static   atomic_int                reload_requested = 0;     // set by the SIGHUP handler
+static   pthread_t                  reload_thread;
+static   pthread_mutex_t       reload_lock = PTHREAD_MUTEX_INITIALIZER;
+static   pthread_cond_t         reload_cond = PTHREAD_COND_INITIALIZER;
+static   bool                          reload_stop = false;
+
+extern void                  sbuffer_print(sbuffer_t * ptr);
+
+/*------------------------------------------------------------------------------
+		function declarations
+------------------------------------------------------------------------------*/
+sensor_map_t *   read_sensor_map   (FILE * fp_sensor_map, const sensor_map_t * old); //build a new map version
 void                   read_sensor_data   (sbuffer_t * sbuffer_ptr_t); //read_sensor_data
-void                   log_message           (sensor_value_t temp, sensor_id_t room); // output the log_message
+static void          start_workers       (void);
+static void *       datamgr_worker      (void * arg);
+static void          track_provisional   (datamgr_worker_t * self, sbuffer_data_t * data_ptr);
+static sensor_node_t * promote_provisional(sensor_id_t sensor_id);
+static void          drop_promoted       (void);
+static void          provisional_unlink  (provisional_table_t * table, provisional_t * p);
+static void          provisional_free    (void);
+static void *       map_reloader         (void * arg);
+static void          reload_sensor_map (void);
+static void          on_sighup             (int sig);
+static void          wait_for_readers    (void);
+static void          map_free               (sensor_map_t * map, const sensor_map_t * successor);
+static sensor_node_t * node_create   (sensor_id_t sensor_id);
+static sensor_map_t * map_acquire     (void);
+static void          map_release          (void);
+static sensor_value_t group_avg       (rollup_level_t level, uint16_t id);
+static void          seqlock_publish    (atomic_uint * seq, atomic_uint_fast64_t * words, const void * data, size_t size);
+static void          seqlock_read        (const atomic_uint * seq, const atomic_uint_fast64_t * words, void * data, size_t size);
+static void          sweep_fleet          (datamgr_worker_t * self);
+static void          sweep_shard          (const map_shard_t * shard, double min, double max, fleet_partial_t * out);
+static void          publish_snapshot   (sensor_node_t * ptr);
+static int           room_limit            (const room_limits_t * limits, uint16_t room, int fallback);
+static void          watch_reading      (datamgr_worker_t * self, const map_entry_t * entry, sensor_value_t value, time_t now);
+static void          watch_expire        (void * ctx, uint32_t timer, time_t now);
+static void          read_snapshot       (const sensor_node_t * ptr, datamgr_sensor_t * out);
+static const map_entry_t * search_entry(const sensor_map_t * map, sensor_id_t sensor_id);
+void                   log_message           (sensor_node_t * ptr); // log alarm transitions of the running average
+static void     report_alarm          (alarm_state_t state, sensor_id_t id, sensor_value_t value, bool room);
+static void     update_rollups        (const sensor_map_t * map, const map_entry_t * entry, sensor_value_t old_avg, bool first);
 sensor_value_t   count_avg               (sensor_node_t * ptr_t);  //caculate the running_avg
-void                   match_with_sensor_data(sensor_node_t * ptr, sbuffer_data_t * data_ptr);
+static double  compensated_sum     (const sensor_value_t * buf, int length);
+static void     window_push           (sensor_node_t * ptr, sensor_value_t value, sensor_ts_t ts);
+static void     update_aggregates  (sensor_node_t * ptr, sensor_value_t value, sensor_ts_t ts, bool evicting, sensor_value_t evicted);
+static void     time_window_push   (sensor_node_t * ptr, sensor_value_t value, sensor_ts_t ts);
+static bool     window_full            (sensor_node_t * ptr);
+static void     deque_push            (minmax_deque_t * q, sensor_value_t value, uint32_t seq, bool keep_max);
+void                   match_with_sensor_data(const sensor_map_t * map, const map_entry_t * entry, sbuffer_data_t * data_ptr);
+static void     aggregate_reading   (const sensor_map_t * map, const map_entry_t * entry, sensor_value_t value, sensor_ts_t ts);
+static void     aggregate_unmapped (sensor_node_t * ptr, sensor_value_t value, sensor_ts_t ts);
+static bool     reorder_admit        (sensor_node_t * ptr, sensor_value_t value, sensor_ts_t ts);
+static bool     reorder_next          (sensor_node_t * ptr, bool flush, held_reading_t * out);
+static void     reorder_flush         (datamgr_worker_t * self);
+static void     reorder_expire       (datamgr_worker_t * self, time_t now, bool all);
 /*------------------------------------------------------------------------------
 		implementation code
 ------------------------------------------------------------------------------*/
-void datamgr_dpl_print( dplist_t * list )
-{
-  int i, length;
-
-  length = dpl_size(list);
-  assert(dplist_errno == DPLIST_NO_ERROR);
-  for ( i = 0; i < length; i++)    
-  {
-    void * element;
-    element = dpl_get_element_at_index(list, i);
-    assert(dplist_errno == DPLIST_NO_ERROR);
-    printf("element at index %d = " "%" PRIu16 "\n", i, ((sensor_node_t *)element)->sensor_id);
-  }
-}
-					
 void datamgr_parse_sensor_data(FILE * fp_sensor_map, sbuffer_t ** buffer){
+  struct sigaction sa = { .sa_handler = on_sighup };
+  int presult;
   
-  read_sensor_map(fp_sensor_map);
+  sensor_map_t * map = read_sensor_map(fp_sensor_map, NULL);
+  fclose(fp_sensor_map);
+  if(map == NULL){
+    fprintf(stderr, "Can't read sensor map %s\n", gw_config.sensor_map);
+    exit(EXIT_FAILURE);
+  }
+  atomic_store(&current_map, map);
+  start_workers();
+  
+  /* reloads happen on SIGHUP or when the map file changes, in their own thread */
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  presult = sigaction(SIGHUP, &sa, NULL);
+  SYSCALL_ERROR(presult);
+  reload_stop = false;
+  presult = pthread_create(&reload_thread, NULL, &map_reloader, NULL);
+  ERROR_HANDLER(presult);
 
   read_sensor_data(*buffer);
+  
+  presult = pthread_mutex_lock(&reload_lock);
+  ERROR_HANDLER(presult);
+  reload_stop = true;
+  presult = pthread_cond_signal(&reload_cond);
+  ERROR_HANDLER(presult);
+  presult = pthread_mutex_unlock(&reload_lock);
+  ERROR_HANDLER(presult);
+  presult = pthread_join(reload_thread, NULL);
+  ERROR_HANDLER(presult);
 }
 
-void read_sensor_map(FILE * fp_sensor_map){
-  sensor_id_t room_ID;
-  sensor_id_t sensor_ID;
+static sensor_node_t * node_create(sensor_id_t sensor_id){
+  const size_t length = gw_config.run_avg_length;
+  const size_t deque_size = gw_config.aggregates & AGG_MINMAX ? 2 * length * sizeof(deque_entry_t) : 0;
+  const size_t bucket_size = gw_config.window_seconds * sizeof(time_bucket_t);
+  const size_t held_size = (gw_config.reorder_depth + 1) * sizeof(held_reading_t);
+  sensor_node_t * node = calloc(1, sizeof(sensor_node_t) + held_size + bucket_size + deque_size + length * sizeof(sensor_value_t));
+  char * extra;
+  assert(node != NULL);
   
-  sensor_avg_list = dpl_create(&datamgr_element_copy, &datamgr_element_free, &datamgr_element_compare);
-  assert(sensor_avg_list != NULL);
+  /* the most strictly aligned arrays come first */
+  extra = (char *)(node + 1);
+  node->held = (held_reading_t *)extra;
+  extra += held_size;
+  node->buckets = bucket_size ? (time_bucket_t *)extra : NULL;
+  extra += bucket_size;
+  if(deque_size){
+    node->min_q.items = (deque_entry_t *)extra;
+    node->max_q.items = node->min_q.items + length;
+  }
+  extra += deque_size;
+  node->buf = (sensor_value_t *)extra;
   
-  sensor_node_t * sensor_ptr = malloc(sizeof(sensor_node_t));
-  assert(sensor_ptr != NULL);
+  node->sensor_id = sensor_id;
+  node->alarm = (alarm_t){ ALARM_NORMAL };
+  node->ewma = node->rate = NAN;
+  publish_snapshot(node);
+  return node;
+}
+
+/*
+ * Reads a compiled map (see mapfile.h) through mmap, or else the 'room_id sensor_id [floor_id [building_id]]' lines of a text map
+ * Sensors that are also in 'old', or tracked provisionally, keep their node (and so their running average and alarm state)
+ * Returns NULL if the map can't be read
+ */
+sensor_map_t * read_sensor_map(FILE * fp_sensor_map, const sensor_map_t * old){
+  mapfile_t file;
+  uint32_t i;
   
-  while( !feof(fp_sensor_map) ){
-    int j = fscanf(fp_sensor_map,  "%16hu %16hu", &room_ID, &sensor_ID);
-    if(j == 2){
-      DEBUG_PRINT("%hu %hu \n", room_ID, sensor_ID);
-      sensor_ptr->room_id = room_ID;
-      sensor_ptr->sensor_id = sensor_ID;
-      sensor_ptr->running_avg = 0;
-      sensor_ptr->timestamp = 0;
-      
-      sensor_ptr->buf_size = 0;
-      
-      sensor_avg_list = dpl_insert_at_index( sensor_avg_list, sensor_ptr, dpl_size(sensor_avg_list), true);
-      assert(sensor_avg_list != NULL);
+  int result = mapfile_open(fileno(fp_sensor_map), &file);
+  if(result == MAPFILE_NOT_BINARY)result = mapfile_parse_text(fp_sensor_map, &file);
+  if(result != MAPFILE_OK)return NULL;
+  
+  sensor_map_t * map = calloc(1, sizeof(sensor_map_t));
+  assert(map != NULL);
+  map->generation = old != NULL ? old->generation + 1 : 1;
+  map->index = calloc(SENSOR_ID_RANGE, sizeof(uint32_t));
+  assert(map->index != NULL);
+  /* a compiled map has one record per sensor, a text map rarely has duplicates */
+  map->entries = malloc(file.count * sizeof(map_entry_t) + 1);
+  assert(map->entries != NULL);
+  map->rollups = rollup_create();
+  map->shard_count = gw_config.datamgr_workers;
+  map->shards = calloc(map->shard_count, sizeof(map_shard_t));
+  assert(map->shards != NULL);
+  
+  /* one linear pass, the records of a compiled map are already sorted by sensor id */
+  for(i = 0; i != file.count; i++){
+    const mapfile_record_t * r = &file.records[i];
+    if(map->index[r->sensor_id] != NO_SLOT){
+      /* the first mapping of a sensor wins, as it did for the list search */
+      DEBUG_PRINT("sensor %hu is mapped twice, ignoring room %hu\n", r->sensor_id, r->room_id);
+      continue;
     }
+    map_entry_t * entry = &map->entries[map->count];
+    const map_entry_t * previous = old != NULL ? search_entry(old, r->sensor_id) : NULL;
+    if(previous != NULL)entry->node = previous->node;
+    else if((entry->node = promote_provisional(r->sensor_id)) == NULL)entry->node = node_create(r->sensor_id);
+    entry->room_id = r->room_id;
+    entry->rollup[ROLLUP_ROOM] = rollup_add_member(map->rollups, ROLLUP_ROOM, r->room_id);
+    entry->rollup[ROLLUP_FLOOR] = r->columns >= 3 ? rollup_add_member(map->rollups, ROLLUP_FLOOR, r->floor_id) : ROLLUP_NONE;
+    entry->rollup[ROLLUP_BUILDING] = r->columns >= 4 ? rollup_add_member(map->rollups, ROLLUP_BUILDING, r->building_id) : ROLLUP_NONE;
+    entry->seeded = false;
+    entry->silence_after = room_limit(&gw_config.room_silence_timeout, r->room_id, gw_config.silence_timeout);
+    entry->flatline_after = room_limit(&gw_config.room_flatline_timeout, r->room_id, gw_config.flatline_timeout);
+    entry->shard_slot = map->shards[r->sensor_id % map->shard_count].count++;
+    map->index[r->sensor_id] = ++map->count;
   }
-  free(sensor_ptr);
-  fclose(fp_sensor_map);
+  mapfile_close(&file);
+  
+  for(int w = 0; w != map->shard_count; w++){
+    map_shard_t * shard = &map->shards[w];
+    shard->entry = malloc(shard->count * sizeof(uint32_t) + 1);
+    shard->avg = malloc(shard->count * sizeof(sensor_value_t) + 1);
+    shard->last_seen = malloc(shard->count * sizeof(sensor_ts_t) + 1);
+    assert(shard->entry != NULL && shard->avg != NULL && shard->last_seen != NULL);
+  }
+  
+  /*
+   * The rollups start from the running averages the kept sensors have now, their workers
+   * replace this seed with the real value on the next reading (see match_with_sensor_data)
+   */
+  for(int i = 0; i != map->count; i++){
+    map_entry_t * entry = &map->entries[i];
+    map_shard_t * shard = &map->shards[entry->node->sensor_id % map->shard_count];
+    datamgr_sensor_t snap;
+    read_snapshot(entry->node, &snap);
+    shard->entry[entry->shard_slot] = i;
+    shard->avg[entry->shard_slot] = snap.avg_ready ? snap.running_avg : NAN;
+    shard->last_seen[entry->shard_slot] = snap.last_modified;
+    if(!snap.avg_ready)continue;
+    entry->seeded = true;
+    entry->seed = snap.running_avg;
+    for(int level = 0; level != ROLLUP_LEVELS; level++){
+      if(entry->rollup[level] != ROLLUP_NONE)rollup_update(map->rollups, level, entry->rollup[level], 0, entry->seed, true);
+    }
+  }
+  if(old != NULL)rollup_inherit_alarms(map->rollups, old->rollups);
+  return map;
 }
 
+/* dispatches the readings of 'sbuffer_ptr_t' to the worker owning each sensor until it stays empty for timeout seconds */
 void read_sensor_data(sbuffer_t * sbuffer_ptr_t){
-  bool loop = true;
-
-  sbuffer_data_t * data_ptr = malloc(sizeof(sbuffer_data_t));
-  assert(data_ptr != NULL);
+  const int workers = pool_size;
+  sbuffer_data_t data;
+  int i, presult;
   
-  while( loop ){
-    int flag = sbuffer_remove_block(sbuffer_ptr_t, data_ptr, TIMEOUT);
+  while( true ){
+    int flag = sbuffer_remove_block(sbuffer_ptr_t, &data, gw_config.timeout);
     if(flag == SBUFFER_SUCCESS){
       //insert into second sbuffer
-      if( sbuffer_insert( sec_buffer, data_ptr) == SBUFFER_FAILURE){
+      if( sbuffer_insert( sec_buffer, &data) == SBUFFER_FAILURE){
 	printf("second sbuffer insertion failure!\n");
 	exit(EXIT_FAILURE);
       }
-
-      sensor_node_t * ptr = search_list(data_ptr->sensor_data.id);
-      
-      match_with_sensor_data( ptr, data_ptr);
       
-      /* force the context switch*/ 
-      usleep(500000);
+      presult = sbuffer_insert( pool[data.sensor_data.id % workers].queue, &data );
+      SBUFFER_ERROR(presult);
     }
     else if (flag == SBUFFER_FAILURE)SBUFFER_ERROR(flag);
     else{
@@ -140,128 +482,1039 @@ void read_sensor_data(sbuffer_t * sbuffer_ptr_t){
     }
   }
   
-  free(data_ptr);
+  /* the storage manager and the workers stop once they have drained their buffer */
+  sbuffer_close(sec_buffer);
+  for(i = 0; i != workers; i++){
+    sbuffer_close(pool[i].queue);
+    presult = pthread_join(pool[i].thread, NULL);
+    ERROR_HANDLER(presult);
+    DEBUG_PRINT("datamgr worker %d processed %ld readings\n", i, pool[i].processed);
+  }
 }
 
-void match_with_sensor_data(sensor_node_t * ptr, sbuffer_data_t * data_ptr){
-  char * send_buf;
-  if(ptr == NULL){
-    DEBUG_PRINT("invalid sensor node ID %" PRIu16 "\n", data_ptr->sensor_data.id);
-    ASPRINTF_ERROR(asprintf( &send_buf, "Received sensor data with invalid sensor node ID %" PRIu16 "\n", data_ptr->sensor_data.id));
-    log_to_fifo( send_buf, fifo_sem, fp );
+/* the pool exists before the reload thread starts, so a reload always sees every worker */
+static void start_workers(void){
+  const int workers = gw_config.datamgr_workers;
+  const bool watch = gw_config.silence_timeout > 0 || gw_config.flatline_timeout > 0
+                     || gw_config.room_silence_timeout.count != 0 || gw_config.room_flatline_timeout.count != 0;
+  int i, presult;
+  
+  if(gw_config.provisional_sensors > 0){
+    provisional_index = calloc(SENSOR_ID_RANGE, sizeof(provisional_t *));
+    assert(provisional_index != NULL);
+  }
+  pool = calloc(workers, sizeof(datamgr_worker_t));
+  assert(pool != NULL);
+  for(i = 0; i != workers; i++){
+    pool[i].index = i;
+    atomic_init(&pool[i].quiescent, 0);
+    presult = pthread_mutex_init(&pool[i].provisional.lock, NULL);
+    ERROR_HANDLER(presult);
+    /* the table is split evenly, each worker only sees its own sensors */
+    pool[i].provisional.capacity = (gw_config.provisional_sensors + workers - 1) / workers;
+    presult = sbuffer_init(&pool[i].queue);
+    SBUFFER_ERROR(presult);
+    if(watch)pool[i].watch = timer_wheel_create((SENSOR_ID_RANGE / workers + 1) * WATCH_KINDS, time(NULL));
+  }
+  atomic_store(&pool_size, workers);
+  for(i = 0; i != workers; i++){
+    presult = pthread_create(&pool[i].thread, NULL, &datamgr_worker, &pool[i]);
+    ERROR_HANDLER(presult);
+  }
+}
+
+static void * datamgr_worker(void * arg){
+  datamgr_worker_t * self = arg;
+  sbuffer_data_t data;
+  
+  while( true ){
+    /* the dispatcher closes the queue when it is done, the timeout lets an idle worker run its sweep and timers */
+    int flag = sbuffer_remove_block(self->queue, &data, FLEET_SWEEP_INTERVAL);
+    const time_t now = time(NULL);
+    if(flag == SBUFFER_SUCCESS){
+      /* the map is only used between these two increments, so a reloader can tell when it was let go */
+      atomic_fetch_add(&self->quiescent, 1);
+      const sensor_map_t * map = atomic_load(&current_map);
+      const map_entry_t * entry = search_entry(map, data.sensor_data.id);
+      if(entry == NULL && provisional_index != NULL)track_provisional( self, &data );
+      else match_with_sensor_data( map, entry, &data );
+      if(entry != NULL && self->watch != NULL)watch_reading( self, entry, data.sensor_data.value, now );
+      atomic_fetch_add(&self->quiescent, 1);
+      self->processed++;
+      self->dirty = true;
+    }
+    else if (flag == SBUFFER_FAILURE)SBUFFER_ERROR(flag);
+    else if (flag == SBUFFER_CLOSED)break;
+    if(self->watch != NULL){
+      /* only the timers of the seconds that passed are looked at, never the whole shard */
+      atomic_fetch_add(&self->quiescent, 1);
+      timer_wheel_advance(self->watch, now, watch_expire, self);
+      atomic_fetch_add(&self->quiescent, 1);
+    }
+    if(now >= self->next_sweep){
+      reorder_expire(self, now, false);
+      sweep_fleet(self);
+    }
+  }
+  reorder_flush(self);
+  sweep_fleet(self);
+  timer_wheel_free(&self->watch);
+  return NULL;
+}
+
+/* recomputes this worker's part of the fleet summary if a reading or a reload changed its shard */
+static void sweep_fleet(datamgr_worker_t * self){
+  fleet_partial_t partial;
+  
+  atomic_fetch_add(&self->quiescent, 1);
+  const sensor_map_t * map = atomic_load(&current_map);
+  if(self->dirty || map->generation != self->swept_generation){
+    sweep_shard(&map->shards[self->index], gw_config.min_temp, gw_config.max_temp, &partial);
+    seqlock_publish(&self->fleet_seq, self->fleet, &partial, sizeof(partial));
+    self->swept_generation = map->generation;
+    self->dirty = false;
+  }
+  atomic_fetch_add(&self->quiescent, 1);
+  self->next_sweep = time(NULL) + FLEET_SWEEP_INTERVAL;
+}
+
+/*
+ * One pass over each column of a shard, without branches on the data: SWEEP_LANES independent accumulators
+ * per statistic so the compiler can keep them in vector registers (NAN averages compare false everywhere)
+ */
+static void sweep_shard(const map_shard_t * shard, double min, double max, fleet_partial_t * out){
+  const sensor_value_t * restrict avg = shard->avg;
+  const sensor_ts_t * restrict seen = shard->last_seen;
+  const int n = shard->count;
+  const int bulk = n - n % SWEEP_LANES;
+  int64_t ready[SWEEP_LANES] = { 0 }, above[SWEEP_LANES] = { 0 }, below[SWEEP_LANES] = { 0 };
+  double sum[SWEEP_LANES] = { 0 };
+  double lo[SWEEP_LANES], hi[SWEEP_LANES];
+  sensor_ts_t oldest[SWEEP_LANES], newest[SWEEP_LANES];
+  int i, l;
+  
+  for(l = 0; l != SWEEP_LANES; l++){
+    lo[l] = INFINITY;
+    hi[l] = -INFINITY;
+    oldest[l] = TIME_MAX;
+    newest[l] = 0;
+  }
+  for(i = 0; i != bulk; i += SWEEP_LANES){
+    for(l = 0; l != SWEEP_LANES; l++){
+      const double a = avg[i + l];
+      ready[l] += a == a;
+      above[l] += a > max;
+      below[l] += a < min;
+      sum[l] += a == a ? a : 0;
+      lo[l] = a < lo[l] ? a : lo[l];
+      hi[l] = a > hi[l] ? a : hi[l];
+    }
+  }
+  for(i = 0; i != bulk; i += SWEEP_LANES){
+    for(l = 0; l != SWEEP_LANES; l++){
+      const sensor_ts_t t = seen[i + l];
+      oldest[l] = t != 0 && t < oldest[l] ? t : oldest[l];
+      newest[l] = t > newest[l] ? t : newest[l];
+    }
+  }
+  /* the last n % SWEEP_LANES sensors go to the first lanes */
+  for(i = bulk, l = 0; i != n; i++, l++){
+    const double a = avg[i];
+    const sensor_ts_t t = seen[i];
+    ready[l] += a == a;
+    above[l] += a > max;
+    below[l] += a < min;
+    sum[l] += a == a ? a : 0;
+    lo[l] = a < lo[l] ? a : lo[l];
+    hi[l] = a > hi[l] ? a : hi[l];
+    oldest[l] = t != 0 && t < oldest[l] ? t : oldest[l];
+    newest[l] = t > newest[l] ? t : newest[l];
+  }
+  
+  *out = (fleet_partial_t){ .sensors = n, .min = INFINITY, .max = -INFINITY, .oldest = TIME_MAX };
+  for(l = 0; l != SWEEP_LANES; l++){
+    out->ready += ready[l];
+    out->above_max += above[l];
+    out->below_min += below[l];
+    out->sum += sum[l];
+    out->min = lo[l] < out->min ? lo[l] : out->min;
+    out->max = hi[l] > out->max ? hi[l] : out->max;
+    out->oldest = oldest[l] < out->oldest ? oldest[l] : out->oldest;
+    out->newest = newest[l] > out->newest ? newest[l] : out->newest;
+  }
+}
+
+/* returns the value 'limits' sets for 'room', or 'fallback' */
+static int room_limit(const room_limits_t * limits, uint16_t room, int fallback){
+  int i;
+  for(i = 0; i != limits->count; i++){
+    if(limits->items[i].room == room)return limits->items[i].seconds;
+  }
+  return fallback;
+}
+
+/*
+ * Ends a silent or stuck state on a new reading of a mapped sensor and arms its timers
+ * An armed timer is left as it is, watch_expire moves it to the real deadline when it fires
+ */
+static void watch_reading(datamgr_worker_t * self, const map_entry_t * entry, sensor_value_t value, time_t now){
+  sensor_node_t * ptr = entry->node;
+  const uint32_t timer = (ptr->sensor_id / pool_size) * WATCH_KINDS;
+  bool changed = false;
+  
+  ptr->heard = now;
+  if(ptr->silent){
+    /* the silent time says nothing about a stuck value, the flatline check starts over */
+    ptr->silent = false;
+    ptr->changed = 0;
+    changed = true;
+    log_event( LOG_EV_SENSOR_RESUMED, ptr->sensor_id, 0 );
+  }
+  if(ptr->changed == 0 || value != ptr->stuck_value){
+    ptr->changed = now;
+    ptr->stuck_value = value;
+    if(ptr->stuck){
+      ptr->stuck = false;
+      changed = true;
+      log_event( LOG_EV_SENSOR_UNSTUCK, ptr->sensor_id, value );
+    }
+  }
+  if(changed)publish_snapshot( ptr );
+  if(entry->silence_after > 0)timer_wheel_arm(self->watch, timer + WATCH_SILENCE, now + entry->silence_after);
+  if(entry->flatline_after > 0 && !ptr->stuck)timer_wheel_arm(self->watch, timer + WATCH_FLATLINE, ptr->changed + entry->flatline_after);
+}
+
+/*
+ * Timers name a sensor id rather than a node, so a reload never leaves one dangling: the sensor is looked up
+ * in the current map and its deadline recomputed from the map's timeouts, an early timer is armed again
+ * Each state is reported once, the timer stays disarmed until watch_reading ends it
+ */
+static void watch_expire(void * ctx, uint32_t timer, time_t now){
+  datamgr_worker_t * self = ctx;
+  const sensor_map_t * map = atomic_load(&current_map);
+  const map_entry_t * entry = search_entry(map, (timer / WATCH_KINDS) * pool_size + self->index);
+  sensor_node_t * ptr;
+  time_t due;
+  
+  if(entry == NULL || entry->node->heard == 0)return;
+  ptr = entry->node;
+  if(timer % WATCH_KINDS == WATCH_SILENCE){
+    if(entry->silence_after == 0 || ptr->silent)return;
+    due = ptr->heard + entry->silence_after;
+    if(due > now){
+      timer_wheel_arm(self->watch, timer, due);
+      return;
+    }
+    ptr->silent = true;
+    log_event( LOG_EV_SENSOR_SILENT, ptr->sensor_id, difftime(now, ptr->heard) );
   }
   else{
-    //update the temperature running_avg and timestamp
-    assert(ptr->sensor_id == data_ptr->sensor_data.id);
-    if(ptr->buf_size < RUN_AVG_LENGTH){
-      ptr->timestamp = data_ptr->sensor_data.ts;
-      ptr->running_avg = 0;
-      
-      ptr->buf[ptr->buf_size] = data_ptr->sensor_data.value;
-      ptr->buf_size++;
-      if(ptr->buf_size == RUN_AVG_LENGTH){
-	ptr->running_avg = count_avg( ptr );
-	log_message( ptr->running_avg, ptr->sensor_id);
+    if(entry->flatline_after == 0 || ptr->stuck)return;
+    due = ptr->changed + entry->flatline_after;
+    if(due > now){
+      timer_wheel_arm(self->watch, timer, due);
+      return;
+    }
+    /* a sensor that stopped reporting is silent, not stuck, the next reading arms the timer again */
+    if(ptr->heard < due)return;
+    ptr->stuck = true;
+    log_event( LOG_EV_SENSOR_STUCK, ptr->sensor_id, ptr->stuck_value );
+  }
+  publish_snapshot( ptr );
+}
+
+/*
+ * Keeps the statistics of a sensor that is not in the map, without room or rollups
+ * The lock only covers the table, the node itself is written by this worker alone and read through its snapshot
+ */
+static void track_provisional(datamgr_worker_t * self, sbuffer_data_t * data_ptr){
+  provisional_table_t * table = &self->provisional;
+  const sensor_id_t id = data_ptr->sensor_data.id;
+  provisional_t * p;
+  bool created = false;
+  int presult;
+  
+  presult = pthread_mutex_lock(&table->lock);
+  ERROR_HANDLER(presult);
+  p = provisional_index[id];
+  if(p != NULL){
+    provisional_unlink(table, p);
+  }
+  else{
+    if(table->count >= table->capacity){
+      /* promoted sensors stay indexed until their map version is published, else a reading could get them a second node */
+      provisional_t * oldest = table->oldest;
+      while(oldest != NULL && oldest->promoted)oldest = oldest->newer;
+      if(oldest != NULL){
+        provisional_unlink(table, oldest);
+        provisional_index[oldest->node->sensor_id] = NULL;
+        free(oldest->node);
+        free(oldest);
       }
     }
-    else{
-      //move every element one cell forward and call the datamgr_get_avg function
-      ptr->timestamp = data_ptr->sensor_data.ts;
-      int j = 0;
-      while(j < RUN_AVG_LENGTH - 1){
-	ptr->buf[j] = ptr->buf[j+1];
-	j++;
+    p = calloc(1, sizeof(provisional_t));
+    assert(p != NULL);
+    p->node = node_create(id);
+    provisional_index[id] = p;
+    created = true;
+  }
+  /* most recently used first */
+  p->older = table->newest;
+  p->newer = NULL;
+  if(table->newest != NULL)table->newest->newer = p;
+  else table->oldest = p;
+  table->newest = p;
+  table->count++;
+  sensor_node_t * ptr = p->node;
+  presult = pthread_mutex_unlock(&table->lock);
+  ERROR_HANDLER(presult);
+  
+  /* log_event may block on the FIFO, a reload promoting sensors of this worker must not wait for that */
+  if(created)log_event( LOG_EV_SENSOR_PROVISIONAL, id, 0 );
+  held_reading_t r;
+  if(reorder_admit(ptr, data_ptr->sensor_data.value, data_ptr->sensor_data.ts)){
+    while(reorder_next(ptr, false, &r))aggregate_unmapped( ptr, r.value, r.ts );
+  }
+  publish_snapshot( ptr );
+}
+
+/* aggregate_reading for a provisional sensor, there is no room to update */
+static void aggregate_unmapped(sensor_node_t * ptr, sensor_value_t value, sensor_ts_t ts){
+  window_push(ptr, value, ts);
+  if(window_full(ptr)){
+    ptr->running_avg = count_avg( ptr );
+    ptr->avg_ready = true;
+    log_message( ptr );
+  }
+}
+
+static void provisional_unlink(provisional_table_t * table, provisional_t * p){
+  if(p->newer != NULL)p->newer->older = p->older;
+  else table->newest = p->older;
+  if(p->older != NULL)p->older->newer = p->newer;
+  else table->oldest = p->newer;
+  p->newer = p->older = NULL;
+  table->count--;
+}
+
+/*
+ * Called while a new map version is built: returns the node of provisional sensor 'sensor_id', or NULL
+ * The owning worker keeps updating the node through the table until the new version is published
+ */
+static sensor_node_t * promote_provisional(sensor_id_t sensor_id){
+  provisional_table_t * table;
+  sensor_node_t * node = NULL;
+  int presult;
+  
+  if(provisional_index == NULL)return NULL;
+  table = &pool[sensor_id % pool_size].provisional;
+  presult = pthread_mutex_lock(&table->lock);
+  ERROR_HANDLER(presult);
+  if(provisional_index[sensor_id] != NULL){
+    provisional_index[sensor_id]->promoted = true;
+    node = provisional_index[sensor_id]->node;
+  }
+  presult = pthread_mutex_unlock(&table->lock);
+  ERROR_HANDLER(presult);
+  return node;
+}
+
+/* after the grace period the workers only reach promoted nodes through the map */
+static void drop_promoted(void){
+  int i, presult;
+  if(provisional_index == NULL)return;
+  for(i = 0; i != pool_size; i++){
+    provisional_table_t * table = &pool[i].provisional;
+    presult = pthread_mutex_lock(&table->lock);
+    ERROR_HANDLER(presult);
+    provisional_t * p = table->newest;
+    while(p != NULL){
+      provisional_t * older = p->older;
+      if(p->promoted){
+        provisional_unlink(table, p);
+        provisional_index[p->node->sensor_id] = NULL;
+        free(p);
       }
-      ptr->buf[RUN_AVG_LENGTH - 1] = data_ptr->sensor_data.value;
-      
-      ptr->running_avg = count_avg( ptr );
-      log_message(ptr->running_avg, ptr->sensor_id);
+      p = older;
     }
+    presult = pthread_mutex_unlock(&table->lock);
+    ERROR_HANDLER(presult);
   }
 }
 
-sensor_node_t * search_list(sensor_id_t sensor_id){
+static void provisional_free(void){
   int i;
-  for(i = 0; i != dpl_size(sensor_avg_list); i++){
-    sensor_node_t * ptr = (sensor_node_t *) dpl_get_element_at_index( sensor_avg_list, i );
-    if(ptr->sensor_id == sensor_id)return ptr;
+  for(i = 0; i != pool_size; i++){
+    provisional_table_t * table = &pool[i].provisional;
+    while(table->oldest != NULL){
+      provisional_t * p = table->oldest;
+      provisional_unlink(table, p);
+      if(!p->promoted)free(p->node);
+      free(p);
+    }
+    pthread_mutex_destroy(&table->lock);
+  }
+  free(provisional_index);
+  provisional_index = NULL;
+}
+
+static void on_sighup(int sig){
+  atomic_store(&reload_requested, 1);
+}
+
+/* checks for SIGHUP every RELOAD_POLL_MS and for a changed map file every map_reload_interval seconds */
+static void * map_reloader(void * arg){
+  struct stat last, now;
+  time_t next_check = time(NULL) + gw_config.map_reload_interval;
+  bool have_last = stat(gw_config.sensor_map, &last) == 0;
+  int presult;
+  
+  presult = pthread_mutex_lock(&reload_lock);
+  ERROR_HANDLER(presult);
+  while(!reload_stop){
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += RELOAD_POLL_MS / 1000;
+    deadline.tv_nsec += (RELOAD_POLL_MS % 1000) * 1000000L;
+    if(deadline.tv_nsec >= 1000000000L){
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&reload_cond, &reload_lock, &deadline);
+    if(reload_stop)break;
+    
+    bool reload = atomic_exchange(&reload_requested, 0);
+    if(gw_config.map_reload_interval > 0 && time(NULL) >= next_check){
+      next_check = time(NULL) + gw_config.map_reload_interval;
+      if(stat(gw_config.sensor_map, &now) == 0){
+        if(!have_last || now.st_mtim.tv_sec != last.st_mtim.tv_sec || now.st_mtim.tv_nsec != last.st_mtim.tv_nsec
+           || now.st_size != last.st_size || now.st_ino != last.st_ino){
+          reload = true;
+        }
+        last = now;
+        have_last = true;
+      }
+    }
+    if(reload){
+      /* the workers never wait for this lock, only datamgr shutdown does */
+      presult = pthread_mutex_unlock(&reload_lock);
+      ERROR_HANDLER(presult);
+      reload_sensor_map();
+      presult = pthread_mutex_lock(&reload_lock);
+      ERROR_HANDLER(presult);
+    }
   }
+  presult = pthread_mutex_unlock(&reload_lock);
+  ERROR_HANDLER(presult);
   return NULL;
 }
 
-uint16_t datamgr_get_room_id(sensor_id_t sensor_id){
+/* builds the new version off the hot path, publishes it and frees the old one after a grace period */
+static void reload_sensor_map(void){
+  sensor_map_t * old = atomic_load(&current_map);
+  sensor_map_t * map;
+  FILE * fp_sensor_map = fopen(gw_config.sensor_map, "r");
+  if(fp_sensor_map == NULL){
+    fprintf(stderr, "Can't reload sensor map %s: %s\n", gw_config.sensor_map, strerror(errno));
+    return;
+  }
+  map = read_sensor_map(fp_sensor_map, old);
+  fclose(fp_sensor_map);
+  if(map == NULL){
+    fprintf(stderr, "Can't reload sensor map %s, keeping the current one\n", gw_config.sensor_map);
+    return;
+  }
+  
+  atomic_store(&current_map, map);
+  wait_for_readers();
+  drop_promoted();
+  map_free(old, map);
+  log_event( LOG_EV_MAP_RELOADED, 0, map->count );
+}
+
+/* returns once every thread that could have loaded the previous current_map has stopped using it */
+static void wait_for_readers(void){
   int i;
-  for(i = 0; i != dpl_size(sensor_avg_list); i++){
-    sensor_node_t * ptr = (sensor_node_t *) dpl_get_element_at_index( sensor_avg_list, i );
-    if(ptr->sensor_id == sensor_id)return ptr->room_id;
+  for(i = 0; i != pool_size; i++){
+    uint_fast64_t q = atomic_load(&pool[i].quiescent);
+    if(q % 2 == 0)continue;                 // idle or between readings, the next one will see the new map
+    while(atomic_load(&pool[i].quiescent) == q)sched_yield();
   }
-  return -1;
+  while(atomic_load(&map_readers) != 0)sched_yield();
 }
 
-void log_message(sensor_value_t temp, sensor_id_t sensor_id){
-  char * send_buf;
-  if(temp > SET_MAX_TEMP){
-    ASPRINTF_ERROR(asprintf( &send_buf, "The sensor node with %" PRIu16 " reports it's too hot (running avg temperature = %g)\n", sensor_id, temp));
-    log_to_fifo( send_buf, fifo_sem, fp );
+/* frees 'map' and the nodes of the sensors that are not in 'successor' */
+static void map_free(sensor_map_t * map, const sensor_map_t * successor){
+  int i;
+  if(map == NULL)return;
+  for(i = 0; i != map->count; i++){
+    if(successor == NULL || search_entry(successor, map->entries[i].node->sensor_id) == NULL){
+      free(map->entries[i].node);
+    }
   }
-  if(temp < SET_MIN_TEMP){
-    ASPRINTF_ERROR(asprintf( &send_buf, "The sensor node with %" PRIu16 " reports it's too cold (running avg temperature = %g)\n", sensor_id, temp));
-    log_to_fifo( send_buf, fifo_sem, fp );
+  rollup_free(&map->rollups);
+  for(i = 0; i != map->shard_count; i++){
+    free(map->shards[i].entry);
+    free(map->shards[i].avg);
+    free(map->shards[i].last_seen);
   }
+  free(map->shards);
+  free(map->entries);
+  free(map->index);
+  free(map);
 }
 
-sensor_value_t count_avg(sensor_node_t * ptr_t){
-    int i;
-    double sum = 0;  
-    for(i = 0; i != RUN_AVG_LENGTH; i++){
-      sum += ptr_t->buf[i];
+static sensor_map_t * map_acquire(void){
+  atomic_fetch_add(&map_readers, 1);
+  return atomic_load(&current_map);
+}
+
+static void map_release(void){
+  atomic_fetch_sub(&map_readers, 1);
+}
+
+static const map_entry_t * search_entry(const sensor_map_t * map, sensor_id_t sensor_id){
+  if(map == NULL || map->index[sensor_id] == NO_SLOT)return NULL;
+  return &map->entries[map->index[sensor_id] - 1];
+}
+
+void match_with_sensor_data(const sensor_map_t * map, const map_entry_t * entry, sbuffer_data_t * data_ptr){
+  if(entry == NULL){
+    DEBUG_PRINT("invalid sensor node ID %" PRIu16 "\n", data_ptr->sensor_data.id);
+    log_event( LOG_EV_SENSOR_INVALID, data_ptr->sensor_data.id, 0 );
+  }
+  else{
+    //update the temperature running_avg and timestamp, in timestamp order
+    sensor_node_t * ptr = entry->node;
+    held_reading_t r;
+    assert(ptr->sensor_id == data_ptr->sensor_data.id);
+    if(!reorder_admit(ptr, data_ptr->sensor_data.value, data_ptr->sensor_data.ts))return;
+    while(reorder_next(ptr, false, &r))aggregate_reading( map, entry, r.value, r.ts );
+  }
+}
+
+/* folds one reading, released by the reorder stage, into the window, the alarms and the rollups */
+static void aggregate_reading(const sensor_map_t * map, const map_entry_t * entry, sensor_value_t value, sensor_ts_t ts){
+  sensor_node_t * ptr = entry->node;
+  window_push(ptr, value, ts);
+  
+  //no average is reported until the window is full
+  if(window_full(ptr)){
+    sensor_value_t old_avg = ptr->running_avg;
+    bool first = false;
+    if(ptr->rollup_gen != map->generation){
+      /* first average since this map version was published, replace the seed or join the rollups */
+      if(entry->seeded)old_avg = entry->seed;
+      else first = true;
+      ptr->rollup_gen = map->generation;
     }
-    return sum/RUN_AVG_LENGTH;
+    ptr->running_avg = count_avg( ptr );
+    ptr->avg_ready = true;
+    log_message( ptr );
+    update_rollups( map, entry, old_avg, first );
+  }
+  publish_snapshot( ptr );
+  
+  const map_shard_t * shard = &map->shards[ptr->sensor_id % map->shard_count];
+  shard->avg[entry->shard_slot] = ptr->avg_ready ? ptr->running_avg : NAN;
+  shard->last_seen[entry->shard_slot] = ptr->timestamp;
 }
 
-sensor_value_t datamgr_get_avg(sensor_id_t sensor_id){
-   sensor_node_t * ptr = search_list(sensor_id);
-   if( ptr == NULL )return -1;
-   return ptr->running_avg;
+/*
+ * Holds a new reading back in the reorder stage, O(log reorder_depth)
+ * Returns false for a late reading, older than one that was already aggregated, or one stamped outside
+ * 0 .. SENSOR_TS_MAX: it is only counted,
+ * the storage manager got it from the dispatcher like every other reading
+ */
+static bool reorder_admit(sensor_node_t * ptr, sensor_value_t value, sensor_ts_t ts){
+  held_reading_t * heap = ptr->held;
+  int i;
+  
+  /* timestamps come over the network unchecked, the window arithmetic only has to cope with sane ones */
+  if(ts < 0 || ts > SENSOR_TS_MAX || (gw_config.reorder_depth > 0 && ptr->seq != 0 && ts < ptr->timestamp)){
+    ptr->late++;
+    atomic_fetch_add(&late_readings, 1);
+    DEBUG_PRINT("late or out of range reading of sensor %" PRIu16 " (timestamp %ld)\n", ptr->sensor_id, (long)ts);
+    publish_snapshot( ptr );
+    return false;
+  }
+  if(ptr->held_count == 0 || ts > ptr->held_newest)ptr->held_newest = ts;
+  if(gw_config.reorder_depth > 0)ptr->held_heard = time(NULL);
+  /* sift up */
+  i = ptr->held_count++;
+  while(i > 0){
+    held_reading_t * parent = &heap[(i - 1) / 2];
+    if(parent->ts < ts || (parent->ts == ts && parent->order < ptr->held_order))break;
+    heap[i] = *parent;
+    i = (i - 1) / 2;
+  }
+  heap[i] = (held_reading_t){ ts, value, ptr->held_order++ };
+  return true;
 }
 
-time_t datamgr_get_last_modified(sensor_id_t sensor_id){
-   sensor_node_t * ptr = search_list(sensor_id);
-   if( ptr == NULL )return -1;
-   return ptr->timestamp; 
+/*
+ * Takes the oldest held reading out of the reorder stage once it can't be overtaken any more: more than
+ * reorder_depth readings are held, or it is reorder_window seconds (sensor time) behind the newest one
+ * With 'flush' every held reading is released. Returns false if nothing is released
+ */
+static bool reorder_next(sensor_node_t * ptr, bool flush, held_reading_t * out){
+  held_reading_t * heap = ptr->held;
+  const int window = gw_config.reorder_window;
+  int i = 0, n;
+  
+  if(ptr->held_count == 0)return false;
+  if(!flush && ptr->held_count <= gw_config.reorder_depth && !(window > 0 && heap[0].ts <= ptr->held_newest - window))return false;
+  *out = heap[0];
+  n = --ptr->held_count;
+  /* sift the last entry down from the root */
+  while(2 * i + 1 < n){
+    int child = 2 * i + 1;
+    if(child + 1 < n && (heap[child + 1].ts < heap[child].ts || (heap[child + 1].ts == heap[child].ts && heap[child + 1].order < heap[child].order)))child++;
+    if(heap[n].ts < heap[child].ts || (heap[n].ts == heap[child].ts && heap[n].order < heap[child].order))break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = heap[n];
+  return true;
 }
 
-int datamgr_get_total_sensors(){
-  return dpl_size(sensor_avg_list);
+/* aggregates what the reorder stage still holds for this worker's sensors, once its queue is closed */
+static void reorder_flush(datamgr_worker_t * self){
+  reorder_expire(self, 0, true);
 }
 
-void datamgr_free(){
-  dpl_free(&sensor_avg_list);
+/*
+ * Aggregates the held readings of this worker's sensors that went quiet: nothing arrived for reorder_window
+ * seconds (REORDER_MAX_AGE without a window), so no reading is left to overtake them. With 'all' every held reading
+ */
+static void reorder_expire(datamgr_worker_t * self, time_t now, bool all){
+  const time_t age = gw_config.reorder_window > 0 ? gw_config.reorder_window : REORDER_MAX_AGE;
+  held_reading_t r;
+  int i, presult;
+  
+  if(gw_config.reorder_depth == 0)return;
+  atomic_fetch_add(&self->quiescent, 1);
+  const sensor_map_t * map = atomic_load(&current_map);
+  const map_shard_t * shard = &map->shards[self->index];
+  for(i = 0; i != shard->count; i++){
+    const map_entry_t * entry = &map->entries[shard->entry[i]];
+    sensor_node_t * ptr = entry->node;
+    if(ptr->held_count == 0 || !(all || now - ptr->held_heard >= age))continue;
+    while(reorder_next(ptr, true, &r))aggregate_reading( map, entry, r.value, r.ts );
+    self->dirty = true;
+  }
+  atomic_fetch_add(&self->quiescent, 1);
+  
+  presult = pthread_mutex_lock(&self->provisional.lock);
+  ERROR_HANDLER(presult);
+  for(provisional_t * p = self->provisional.newest; p != NULL; p = p->older){
+    sensor_node_t * ptr = p->node;
+    if(ptr->held_count == 0 || !(all || now - ptr->held_heard >= age))continue;
+    while(reorder_next(ptr, true, &r))aggregate_unmapped( ptr, r.value, r.ts );
+    publish_snapshot( ptr );
+  }
+  presult = pthread_mutex_unlock(&self->provisional.lock);
+  ERROR_HANDLER(presult);
 }
 
-void * datamgr_element_copy(void * element){ 	// Duplicate 'element'; If needed allocated new memory for the duplicated element.
-  sensor_node_t *p;
-  p = malloc( sizeof( sensor_node_t ));
-  assert ( p != NULL );
-  *p = *( sensor_node_t *)element;
-  return (void *)p;
+/*
+ * Publishes the state of 'ptr' for datamgr_get_sensor, only called by the worker that owns it (or before the node is shared)
+ */
+static void publish_snapshot(sensor_node_t * ptr){
+  const int aggregates = gw_config.aggregates;
+  datamgr_sensor_t snap = {
+    .sensor_id = ptr->sensor_id,
+    .room_id = (uint16_t)-1,
+    .avg_ready = ptr->avg_ready,
+    .running_avg = ptr->running_avg,
+    .ewma = aggregates & AGG_EWMA ? ptr->ewma : NAN,
+    .min = aggregates & AGG_MINMAX && ptr->min_q.count != 0 ? ptr->min_q.items[ptr->min_q.head].value : NAN,
+    .max = aggregates & AGG_MINMAX && ptr->max_q.count != 0 ? ptr->max_q.items[ptr->max_q.head].value : NAN,
+    .rate = aggregates & AGG_RATE ? ptr->rate : NAN,
+    .last_modified = ptr->timestamp,
+    .late_readings = ptr->late,
+    .silent = ptr->silent,
+    .stuck = ptr->stuck,
+  };
+  if( !(aggregates & AGG_VARIANCE) || ptr->buf_size == 0 )snap.variance = NAN;
+  else snap.variance = ptr->buf_size == 1 ? 0 : ptr->m2 / (ptr->buf_size - 1);
+  
+  seqlock_publish(&ptr->snapshot_seq, ptr->snapshot, &snap, sizeof(snap));
 }
 
-void datamgr_element_free(void ** element){	// If needed, free memory allocated to element
-  free(*element);
-  *element = NULL;
+static void read_snapshot(const sensor_node_t * ptr, datamgr_sensor_t * out){
+  seqlock_read(&ptr->snapshot_seq, ptr->snapshot, out, sizeof(datamgr_sensor_t));
 }
 
-int datamgr_element_compare(void * x, void * y){ // Compare two element elements; returns -1 if x<y, 0 if x==y, or 1 if x>y 
-  sensor_node_t * a = (sensor_node_t *)x;
-  sensor_node_t * b = (sensor_node_t *)y;
-  if (a->room_id < b->room_id){
-    return -1;
+/*
+ * Seqlock writer: only one thread may publish to 'seq', readers never block it
+ * 'data' is stored as 64 bit atomic words, so a torn read is detected by the reader, never undefined
+ */
+static void seqlock_publish(atomic_uint * seq, atomic_uint_fast64_t * words, const void * data, size_t size){
+  unsigned start = atomic_load_explicit(seq, memory_order_relaxed);
+  size_t i;
+  
+  atomic_store_explicit(seq, start + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  for(i = 0; i * sizeof(uint64_t) < size; i++){
+    uint64_t word = 0;
+    memcpy(&word, (const char *)data + i * sizeof(uint64_t), size - i * sizeof(uint64_t) < sizeof(uint64_t) ? size - i * sizeof(uint64_t) : sizeof(uint64_t));
+    atomic_store_explicit(&words[i], word, memory_order_relaxed);
   }
-  else if (a->room_id == b->room_id  && a->sensor_id == b->sensor_id){
-    return 0;
+  atomic_store_explicit(seq, start + 2, memory_order_release);
+}
+
+/* seqlock reader: retries while a write is in progress, so it never returns half written data */
+static void seqlock_read(const atomic_uint * seq, const atomic_uint_fast64_t * words, void * data, size_t size){
+  unsigned before, after;
+  size_t i;
+  
+  do{
+    before = atomic_load_explicit(seq, memory_order_acquire);
+    for(i = 0; i * sizeof(uint64_t) < size; i++){
+      uint64_t word = atomic_load_explicit(&words[i], memory_order_relaxed);
+      memcpy((char *)data + i * sizeof(uint64_t), &word, size - i * sizeof(uint64_t) < sizeof(uint64_t) ? size - i * sizeof(uint64_t) : sizeof(uint64_t));
+    }
+    atomic_thread_fence(memory_order_acquire);
+    after = atomic_load_explicit(seq, memory_order_relaxed);
+  }while(before != after || before % 2 != 0);
+}
+
+/* O(1): the new reading replaces the oldest one in the circular window and in the running sum */
+static void window_push(sensor_node_t * ptr, sensor_value_t value, sensor_ts_t ts){
+  const int length = gw_config.run_avg_length;
+  int i;
+  const bool evicting = ptr->buf_size == length;
+  sensor_value_t evicted = 0;
+  
+  if(!evicting){
+    ptr->buf[(ptr->head + ptr->buf_size) % length] = value;
+    ptr->buf_size++;
+    ptr->sum += value;
   }
   else{
-    return 1;
+    evicted = ptr->buf[ptr->head];
+    ptr->sum += value - evicted;
+    ptr->buf[ptr->head] = value;
+    ptr->head = ptr->head + 1 == length ? 0 : ptr->head + 1;
+  }
+  
+  if(gw_config.aggregates != 0)update_aggregates(ptr, value, ts, evicting, evicted);
+  if(gw_config.window_seconds > 0)time_window_push(ptr, value, ts);
+  ptr->timestamp = ts;
+  ptr->seq++;
+  
+  if(++ptr->since_resum >= RESUM_PERIOD && ptr->since_resum >= length){
+    ptr->sum = compensated_sum(ptr->buf, ptr->buf_size);
+    if(gw_config.window_seconds > 0){
+      double time_sum = 0;
+      for(i = 0; i != gw_config.window_seconds; i++)time_sum += ptr->buckets[i].sum;
+      ptr->time_sum = time_sum;
+    }
+    if(gw_config.aggregates & AGG_VARIANCE){
+      /* exact two-pass recomputation, the sliding update drifts like the sum */
+      double m2 = 0;
+      ptr->mean = ptr->sum / ptr->buf_size;
+      for(i = 0; i != ptr->buf_size; i++)m2 += (ptr->buf[i] - ptr->mean) * (ptr->buf[i] - ptr->mean);
+      ptr->m2 = m2;
+    }
+    ptr->since_resum = 0;
+  }
+}
+
+/* called before ptr->seq moves on to the new reading */
+/* slot of second 'ts' in the ring of window_seconds buckets, never negative */
+static inline int bucket_of(sensor_ts_t ts, int seconds){
+  return (int)(((ts % seconds) + seconds) % seconds);
+}
+
+static void time_window_push(sensor_node_t * ptr, sensor_value_t value, sensor_ts_t ts){
+  const int seconds = gw_config.window_seconds;
+  time_bucket_t * b;
+  
+  if(ptr->seq == 0){
+    /* every bucket is cleared below */
+    ptr->first_ts = ts;
+    ptr->newest = ts - seconds;
+  }
+  if(ts > ptr->newest){
+    /* evict the seconds the window moves past, at most one full turn of the ring */
+    sensor_ts_t t = ts - ptr->newest > seconds ? ts - seconds + 1 : ptr->newest + 1;
+    for(; t <= ts; t++){
+      b = &ptr->buckets[bucket_of(t, seconds)];
+      ptr->time_sum -= b->sum;
+      ptr->time_count -= b->count;
+      b->second = t;
+      b->sum = 0;
+      b->count = 0;
+    }
+    if(ptr->time_count == 0)ptr->time_sum = 0;
+    ptr->newest = ts;
+  }
+  else if(ts <= ptr->newest - seconds){
+    /* late reading that is already outside the window */
+    return;
+  }
+  
+  b = &ptr->buckets[bucket_of(ts, seconds)];
+  assert(b->second == ts);
+  b->sum += value;
+  b->count++;
+  ptr->time_sum += value;
+  ptr->time_count++;
+}
+
+/* an average is reported once the window covers run_avg_length readings or window_seconds seconds */
+static bool window_full(sensor_node_t * ptr){
+  if(gw_config.window_seconds > 0)return ptr->newest - ptr->first_ts >= gw_config.window_seconds - 1 && ptr->time_count != 0;
+  return ptr->buf_size == gw_config.run_avg_length;
+}
+
+/* called before ptr->timestamp and ptr->seq move on to the new reading */
+static void update_aggregates(sensor_node_t * ptr, sensor_value_t value, sensor_ts_t ts, bool evicting, sensor_value_t evicted){
+  const int aggregates = gw_config.aggregates;
+  
+  if(aggregates & AGG_EWMA){
+    if(ptr->seq == 0)ptr->ewma = value;
+    else ptr->ewma += gw_config.ewma_alpha * (value - ptr->ewma);
+  }
+  
+  if(aggregates & AGG_VARIANCE){
+    double old_mean = ptr->mean;
+    if(!evicting){
+      /* Welford: the window grows by one */
+      ptr->mean += (value - old_mean) / ptr->buf_size;
+      ptr->m2 += (value - old_mean) * (value - ptr->mean);
+    }
+    else{
+      /* the same update for a fixed size window, 'value' replaces 'evicted' */
+      ptr->mean += (value - evicted) / ptr->buf_size;
+      ptr->m2 += (value - evicted) * (value - ptr->mean + evicted - old_mean);
+      if(ptr->m2 < 0)ptr->m2 = 0;
+    }
+  }
+  
+  if(aggregates & AGG_MINMAX){
+    deque_push(&ptr->min_q, value, ptr->seq, false);
+    deque_push(&ptr->max_q, value, ptr->seq, true);
   }
-}
\ No newline at end of file
+  
+  if(aggregates & AGG_RATE){
+    /* readings with the same timestamp keep the previous rate */
+    if(ptr->seq != 0 && ts != ptr->timestamp)ptr->rate = (value - ptr->last_value) / difftime(ts, ptr->timestamp);
+    ptr->last_value = value;
+  }
+}
+
+/* amortised O(1): every reading is pushed and dropped at most once */
+static void deque_push(minmax_deque_t * q, sensor_value_t value, uint32_t seq, bool keep_max){
+  const int capacity = gw_config.run_avg_length;
+  
+  /* readings that left the window */
+  while(q->count != 0 && seq - q->items[q->head].seq >= (uint32_t)capacity){
+    q->head = q->head + 1 == capacity ? 0 : q->head + 1;
+    q->count--;
+  }
+  /* readings that can never be the minimum (maximum) again */
+  while(q->count != 0){
+    sensor_value_t back = q->items[(q->head + q->count - 1) % capacity].value;
+    if(keep_max ? back > value : back < value)break;
+    q->count--;
+  }
+  q->items[(q->head + q->count) % capacity] = (deque_entry_t){ value, seq };
+  q->count++;
+}
+
+
+void log_message(sensor_node_t * ptr){
+  alarm_state_t report;
+  if(alarm_update(&ptr->alarm, ptr->running_avg, ptr->timestamp, gw_config.min_temp, gw_config.max_temp, &report)){
+    report_alarm( report, ptr->sensor_id, ptr->running_avg, false );
+  }
+}
+
+static void report_alarm(alarm_state_t state, sensor_id_t id, sensor_value_t value, bool room){
+  switch(state){
+    case ALARM_HOT:
+      log_event( room ? LOG_EV_ROOM_TOO_HOT : LOG_EV_TOO_HOT, id, value );
+      break;
+    case ALARM_COLD:
+      log_event( room ? LOG_EV_ROOM_TOO_COLD : LOG_EV_TOO_COLD, id, value );
+      break;
+    default:
+      log_event( room ? LOG_EV_ROOM_NORMAL : LOG_EV_TEMP_NORMAL, id, value );
+      break;
+  }
+}
+
+/* the room average is checked against its own thresholds, floors and buildings are only aggregated */
+static void update_rollups(const sensor_map_t * map, const map_entry_t * entry, sensor_value_t old_avg, bool first){
+  const sensor_node_t * ptr = entry->node;
+  sensor_value_t room_avg;
+  alarm_state_t report;
+  int level;
+  
+  for(level = 0; level != ROLLUP_LEVELS; level++){
+    if(entry->rollup[level] != ROLLUP_NONE){
+      rollup_update(map->rollups, level, entry->rollup[level], old_avg, ptr->running_avg, first);
+    }
+  }
+  if(rollup_check_alarm(map->rollups, ROLLUP_ROOM, entry->rollup[ROLLUP_ROOM], ptr->timestamp,
+                        gw_config.room_min_temp, gw_config.room_max_temp, &report, &room_avg)){
+    report_alarm( report, entry->room_id, room_avg, true );
+  }
+}
+static double compensated_sum(const sensor_value_t * buf, int length){
+  double sum = 0, c = 0;
+  int i;
+  for(i = 0; i != length; i++){
+    double t = sum + buf[i];
+    if(fabs(sum) >= fabs(buf[i]))c += (sum - t) + buf[i];
+    else c += (buf[i] - t) + sum;
+    sum = t;
+  }
+  return sum + c;
+}
+
+sensor_value_t count_avg(sensor_node_t * ptr_t){
+    if(gw_config.window_seconds > 0)return ptr_t->time_sum / ptr_t->time_count;
+    return ptr_t->sum / ptr_t->buf_size;
+}
+
+
+uint16_t datamgr_get_room_id(sensor_id_t sensor_id){
+  const map_entry_t * entry = search_entry(map_acquire(), sensor_id);
+  uint16_t room_id = entry != NULL ? entry->room_id : (uint16_t)-1;
+  map_release();
+  return room_id;
+}
+
+int datamgr_get_sensor(sensor_id_t sensor_id, datamgr_sensor_t * sensor){
+  const sensor_map_t * map = map_acquire();
+  const map_entry_t * entry = search_entry(map, sensor_id);
+  int result = -1;
+  int presult;
+  
+  if(entry != NULL){
+    read_snapshot(entry->node, sensor);
+    sensor->room_id = entry->room_id;
+    result = 0;
+  }
+  else if(atomic_load(&pool_size) != 0 && provisional_index != NULL){
+    /* provisional sensors can be evicted, the table lock keeps the node alive while it is read */
+    provisional_table_t * table = &pool[sensor_id % pool_size].provisional;
+    presult = pthread_mutex_lock(&table->lock);
+    ERROR_HANDLER(presult);
+    if(provisional_index[sensor_id] != NULL){
+      read_snapshot(provisional_index[sensor_id]->node, sensor);
+      result = 0;
+    }
+    presult = pthread_mutex_unlock(&table->lock);
+    ERROR_HANDLER(presult);
+  }
+  map_release();
+  return result;
+}
+
+void datamgr_get_fleet(datamgr_fleet_t * fleet){
+  fleet_partial_t partial;
+  double sum = 0;
+  int i;
+  
+  *fleet = (datamgr_fleet_t){ .min_avg = NAN, .max_avg = NAN, .mean_avg = NAN };
+  for(i = 0; i != pool_size; i++){
+    seqlock_read(&pool[i].fleet_seq, pool[i].fleet, &partial, sizeof(partial));
+    fleet->sensors += partial.sensors;
+    fleet->above_max += partial.above_max;
+    fleet->below_min += partial.below_min;
+    if(partial.ready != 0){
+      fleet->min_avg = fleet->ready == 0 || partial.min < fleet->min_avg ? partial.min : fleet->min_avg;
+      fleet->max_avg = fleet->ready == 0 || partial.max > fleet->max_avg ? partial.max : fleet->max_avg;
+      fleet->ready += partial.ready;
+      sum += partial.sum;
+    }
+    if(partial.newest != 0){
+      fleet->oldest_reading = fleet->oldest_reading == 0 || partial.oldest < fleet->oldest_reading ? partial.oldest : fleet->oldest_reading;
+      fleet->newest_reading = partial.newest > fleet->newest_reading ? partial.newest : fleet->newest_reading;
+    }
+  }
+  if(fleet->ready != 0)fleet->mean_avg = sum / fleet->ready;
+  fleet->late_readings = atomic_load(&late_readings);
+}
+
+sensor_value_t datamgr_get_avg(sensor_id_t sensor_id){
+   datamgr_sensor_t sensor;
+   if( datamgr_get_sensor(sensor_id, &sensor) != 0 )return -1;
+   return sensor.running_avg;
+}
+
+sensor_value_t datamgr_get_ewma(sensor_id_t sensor_id){
+   datamgr_sensor_t sensor;
+   if( datamgr_get_sensor(sensor_id, &sensor) != 0 )return -1;
+   return sensor.ewma;
+}
+
+sensor_value_t datamgr_get_min(sensor_id_t sensor_id){
+   datamgr_sensor_t sensor;
+   if( datamgr_get_sensor(sensor_id, &sensor) != 0 )return -1;
+   return sensor.min;
+}
+
+sensor_value_t datamgr_get_max(sensor_id_t sensor_id){
+   datamgr_sensor_t sensor;
+   if( datamgr_get_sensor(sensor_id, &sensor) != 0 )return -1;
+   return sensor.max;
+}
+
+sensor_value_t datamgr_get_variance(sensor_id_t sensor_id){
+   datamgr_sensor_t sensor;
+   if( datamgr_get_sensor(sensor_id, &sensor) != 0 )return -1;
+   return sensor.variance;
+}
+
+sensor_value_t datamgr_get_rate(sensor_id_t sensor_id){
+   datamgr_sensor_t sensor;
+   if( datamgr_get_sensor(sensor_id, &sensor) != 0 )return -1;
+   return sensor.rate;
+}
+
+static sensor_value_t group_avg(rollup_level_t level, uint16_t id){
+   const sensor_map_t * map = map_acquire();
+   sensor_value_t value = map != NULL ? rollup_get_avg(map->rollups, level, id) : -1;
+   map_release();
+   return value;
+}
+
+sensor_value_t datamgr_get_room_avg(uint16_t room_id){
+   return group_avg(ROLLUP_ROOM, room_id);
+}
+
+sensor_value_t datamgr_get_floor_avg(uint16_t floor_id){
+   return group_avg(ROLLUP_FLOOR, floor_id);
+}
+
+sensor_value_t datamgr_get_building_avg(uint16_t building_id){
+   return group_avg(ROLLUP_BUILDING, building_id);
+}
+
+time_t datamgr_get_last_modified(sensor_id_t sensor_id){
+   datamgr_sensor_t sensor;
+   if( datamgr_get_sensor(sensor_id, &sensor) != 0 )return -1;
+   return sensor.last_modified;
+}
+
+int datamgr_get_total_sensors(){
+  const sensor_map_t * map = map_acquire();
+  int count = map != NULL ? map->count : 0;
+  map_release();
+  return count;
+}
+
+void datamgr_free(){
+  map_free(atomic_exchange(&current_map, NULL), NULL);
+  provisional_free();
+  for(int i = 0; i != atomic_load(&pool_size); i++)sbuffer_free(&pool[i].queue);
+  free(pool);
+  pool = NULL;
+  atomic_store(&pool_size, 0);
+}
@@ -3,28 +3,133 @@
 
 #include <time.h>
 #include <stdio.h>
+#include <stdbool.h>
 #include "config.h"
 #include "sbuffer.h"
-#include "lib/dplist.h"
 
+/*
+ * Compile time defaults, the values in use are gw_config.run_avg_length, .window_seconds, .datamgr_workers,
+ * .max_temp and .min_temp
+ */
 #ifndef RUN_AVG_LENGTH
   #define RUN_AVG_LENGTH 5
 #endif
 
+#ifndef WINDOW_SECONDS
+  #define WINDOW_SECONDS 0             // > 0: average over the readings of the last WINDOW_SECONDS seconds instead
+#endif
+
+#ifndef DATAMGR_WORKERS
+  #define DATAMGR_WORKERS 2            // threads processing readings, each owns a disjoint set of sensors
+#endif
+
+#ifndef PROVISIONAL_SENSORS
+  #define PROVISIONAL_SENSORS 0       // unknown sensors tracked until the map lists them, 0 = readings of unknown sensors are dropped
+#endif
+
+#ifndef MAP_RELOAD_INTERVAL
+  #define MAP_RELOAD_INTERVAL 1       // seconds between checks of the sensor map file for changes, 0 = reload on SIGHUP only
+#endif
+
+#ifndef SILENCE_TIMEOUT
+  #define SILENCE_TIMEOUT 0            // seconds without readings before a sensor is reported silent, 0 = not watched
+#endif
+
+#ifndef FLATLINE_TIMEOUT
+  #define FLATLINE_TIMEOUT 0           // seconds of one unchanged value before a sensor is reported stuck, 0 = not watched
+#endif
+
+#ifndef REORDER_DEPTH
+  #define REORDER_DEPTH 0              // readings per sensor held back to be aggregated in timestamp order, 0 = arrival order
+#endif
+
+#ifndef REORDER_WINDOW
+  #define REORDER_WINDOW 0             // > 0: a held reading is also released once it is this many seconds behind the newest one
+#endif
+
+#ifndef REORDER_MAX_AGE
+  #define REORDER_MAX_AGE 10           // with reorder_window 0: seconds after its last reading that a quiet sensor's held readings are aggregated
+#endif
+
 #ifndef SET_MAX_TEMP
-  #error SET_MAX_TEMP not set
+  #define SET_MAX_TEMP 20
 #endif
 
 #ifndef SET_MIN_TEMP
-  #error SET_MIN_TEMP not set
+  #define SET_MIN_TEMP 10
+#endif
+
+#ifndef SET_ROOM_MAX_TEMP
+  #define SET_ROOM_MAX_TEMP NAN     // thresholds of the room average, gw_config.room_max_temp and .room_min_temp, NAN = max_temp / min_temp
+#endif
+
+#ifndef SET_ROOM_MIN_TEMP
+  #define SET_ROOM_MIN_TEMP NAN
+#endif
+
+/*
+ * Streaming statistics kept per sensor next to the running average, selected with gw_config.aggregates
+ * Each one is updated in O(1) per reading
+ */
+#define AGG_EWMA          (1 << 0)      // exponentially weighted moving average with weight gw_config.ewma_alpha
+#define AGG_MINMAX       (1 << 1)      // minimum and maximum of the last run_avg_length readings
+#define AGG_VARIANCE    (1 << 2)      // sample variance of the last run_avg_length readings
+#define AGG_RATE           (1 << 3)      // change per second between the last two readings
+
+#ifndef DATAMGR_AGGREGATES
+  #define DATAMGR_AGGREGATES (AGG_EWMA | AGG_MINMAX | AGG_VARIANCE | AGG_RATE)
 #endif
 
+#ifndef EWMA_ALPHA
+  #define EWMA_ALPHA 0.2
+#endif
+
+#define DATAMGR_MAX_WORKERS 64
+#define REORDER_MAX_DEPTH   4096
+#define SENSOR_TS_MAX          ((sensor_ts_t)1 << 40)   // readings stamped outside 0 .. SENSOR_TS_MAX are stored but not aggregated
+
 #define NUM_SENSORS 8
 
+/*
+ * Consistent copy of the state of one sensor, see datamgr_get_sensor
+ */
+typedef struct{
+  sensor_id_t        sensor_id;
+  uint16_t            room_id;               // -1 for a provisional sensor
+  bool                  avg_ready;           // running_avg covers a full window
+  sensor_value_t   running_avg;
+  sensor_value_t   ewma;                  // the statistics are NAN when not enabled in gw_config.aggregates or without readings
+  sensor_value_t   min;
+  sensor_value_t   max;
+  sensor_value_t   variance;
+  sensor_value_t   rate;
+  sensor_ts_t         last_modified;
+  uint32_t            late_readings;       // readings that arrived after a newer one was aggregated (gw_config.reorder_depth > 0)
+  bool                  silent;                 // reported silent (gw_config.silence_timeout) and no reading since
+  bool                  stuck;                  // reported stuck (gw_config.flatline_timeout) and no new value since
+}datamgr_sensor_t;
+
+/*
+ * Summary of all sensors in the map, see datamgr_get_fleet
+ */
+typedef struct{
+  int                    sensors;
+  int                    ready;                 // sensors with a running average
+  int                    above_max;          // running average above gw_config.max_temp
+  int                    below_min;          // running average below gw_config.min_temp
+  sensor_value_t  min_avg;             // lowest, highest and mean running average, NAN if none is ready
+  sensor_value_t  max_avg;
+  sensor_value_t  mean_avg;
+  sensor_ts_t        oldest_reading;   // least and most recent last reading of a sensor, 0 if there are none
+  sensor_ts_t        newest_reading;
+  long                  late_readings;       // of all sensors since datamgr started, stored but not aggregated
+}datamgr_fleet_t;
+
 /*
  * Reads continiously all data from the shared buffer data structure, parse the room_id's
  * and calculate the running avarage for all sensor ids
  * When *buffer becomes NULL the method finishes. This method will NOT automatically free all used memory
+ * The map is read again on SIGHUP or when gw_config.sensor_map changes, sensors that stay keep their state
  */
 void datamgr_parse_sensor_data(FILE * fp_sensor_map, sbuffer_t ** buffer);
 
@@ -36,7 +141,21 @@ void datamgr_parse_sensor_data(FILE * fp_sensor_map, sbuffer_t ** buffer);
 void datamgr_free();
 
 /*
- * Gets the room ID for a certain sensor ID
+ * Copies the current state of a sensor into '*sensor', all fields from the same update
+ * Safe from any number of threads at once, readers never block the datamgr workers
+ * Returns 0, or -1 if the sensor is neither in the map nor tracked provisionally
+ */
+int datamgr_get_sensor(sensor_id_t sensor_id, datamgr_sensor_t * sensor);
+
+/*
+ * Fills in '*fleet' from the latest sweeps of the workers, which scan their sensors at most once a second
+ * when something changed, so the summary lags the readings by up to a second
+ */
+void datamgr_get_fleet(datamgr_fleet_t * fleet);
+
+/*
+ * Gets the room ID for a certain sensor ID, -1 for a sensor that is not in the map
+ * The other per sensor getters below also answer for provisional sensors (see gw_config.provisional_sensors)
  */
 uint16_t datamgr_get_room_id(sensor_id_t sensor_id);
 
@@ -45,6 +164,26 @@ uint16_t datamgr_get_room_id(sensor_id_t sensor_id);
  */
 sensor_value_t datamgr_get_avg(sensor_id_t sensor_id);
 
+/*
+ * Statistics of a certain sensor ID, see AGG_*
+ * Like datamgr_get_avg they return -1 for an unknown sensor ID,
+ * and NAN when the statistic is not enabled in gw_config.aggregates or has no readings yet
+ */
+sensor_value_t datamgr_get_ewma(sensor_id_t sensor_id);
+sensor_value_t datamgr_get_min(sensor_id_t sensor_id);
+sensor_value_t datamgr_get_max(sensor_id_t sensor_id);
+sensor_value_t datamgr_get_variance(sensor_id_t sensor_id);
+sensor_value_t datamgr_get_rate(sensor_id_t sensor_id);
+
+/*
+ * Gets the average of the running averages of the sensors in a room, floor or building
+ * (floor and building come from the optional third and fourth column of the sensor map)
+ * Returns NAN if none of its sensors has a running average yet, -1 if the ID is not in the sensor map
+ */
+sensor_value_t datamgr_get_room_avg(uint16_t room_id);
+sensor_value_t datamgr_get_floor_avg(uint16_t floor_id);
+sensor_value_t datamgr_get_building_avg(uint16_t building_id);
+
 /*
  * Returns the time of the last reading for a certain sensor ID
  */
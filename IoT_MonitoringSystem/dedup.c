@@ -0,0 +1,72 @@
+#define _GNU_SOURCE
+/*-----------------------------------------------------------------------------
+		include files
+------------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "dedup.h"
+
+/*------------------------------------------------------------------------------
+		definitions (defines, typedefs, ...)
+------------------------------------------------------------------------------*/
+#define SENSOR_ID_RANGE   (UINT16_MAX + 1)
+
+typedef struct{
+  sensor_ts_t         newest;
+  uint32_t              next;                   // slot the next reading overwrites
+  uint32_t              count;
+  sensor_ts_t         ts[DEDUP_SLOTS];
+  sensor_value_t   value[DEDUP_SLOTS];
+}history_t;
+
+struct dedup{
+  int                       horizon;
+  history_t **         sensors;              // sensor id -> history, NULL until the first reading
+};
+
+/*------------------------------------------------------------------------------
+		implementation code
+------------------------------------------------------------------------------*/
+dedup_t * dedup_create(int horizon){
+  dedup_t * filter = malloc(sizeof(dedup_t));
+  assert(filter != NULL);
+  filter->horizon = horizon;
+  filter->sensors = calloc(SENSOR_ID_RANGE, sizeof(history_t *));
+  assert(filter->sensors != NULL);
+  return filter;
+}
+
+bool dedup_seen(dedup_t * filter, const sensor_data_t * data){
+  history_t * h = filter->sensors[data->id];
+  uint32_t i;
+  
+  if(h == NULL){
+    h = calloc(1, sizeof(history_t));
+    assert(h != NULL);
+    filter->sensors[data->id] = h;
+  }
+  else{
+    if(data->ts < h->newest - filter->horizon)return false;
+    for(i = 0; i != h->count; i++){
+      if(h->ts[i] == data->ts && h->value[i] == data->value)return true;
+    }
+  }
+  h->ts[h->next] = data->ts;
+  h->value[h->next] = data->value;
+  h->next = (h->next + 1) & (DEDUP_SLOTS - 1);
+  if(h->count != DEDUP_SLOTS)h->count++;
+  if(h->count == 1 || data->ts > h->newest)h->newest = data->ts;
+  return false;
+}
+
+void dedup_free(dedup_t ** filter){
+  int i;
+  if(filter == NULL || *filter == NULL)return;
+  for(i = 0; i != SENSOR_ID_RANGE; i++)free((*filter)->sensors[i]);
+  free((*filter)->sensors);
+  free(*filter);
+  *filter = NULL;
+}
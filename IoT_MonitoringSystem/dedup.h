@@ -0,0 +1,38 @@
+#ifndef _DEDUP_H_
+#define _DEDUP_H_
+
+#include <stdbool.h>
+#include "config.h"
+
+#ifndef DEDUP_HORIZON
+  #define DEDUP_HORIZON 0               // seconds (sensor time) behind a sensor's newest reading that are checked for duplicates, 0 = off
+#endif
+
+#ifndef DEDUP_SLOTS
+  #define DEDUP_SLOTS 8                 // recent readings remembered per sensor, a power of 2
+#endif
+
+/*
+ * Filter of retransmitted readings: for every sensor it remembers the last DEDUP_SLOTS readings within
+ * 'horizon' seconds of the newest one, a reading with the same timestamp and value as one of them is a duplicate
+ * Memory is only allocated for sensors that send readings. Not thread safe: one filter belongs to one thread
+ */
+typedef struct dedup dedup_t;
+
+/*
+ * Returns an empty filter
+ */
+dedup_t * dedup_create(int horizon);
+
+/*
+ * Returns true if 'data' repeats a recent reading of its sensor, otherwise remembers it and returns false
+ * Readings older than the horizon can't be checked and are never reported as duplicates
+ */
+bool dedup_seen(dedup_t * filter, const sensor_data_t * data);
+
+/*
+ * Frees the filter
+ */
+void dedup_free(dedup_t ** filter);
+
+#endif /* _DEDUP_H_ */
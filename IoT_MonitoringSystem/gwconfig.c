@@ -0,0 +1,428 @@
+#define _GNU_SOURCE
+/*-----------------------------------------------------------------------------
+		include files
+------------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+
+#include "gwconfig.h"
+#include "datamgr.h"
+#include "connmgr.h"
+#include "sensor_db.h"
+#include "logfile.h"
+#include "logring.h"
+#include "lograte.h"
+#include "alarm.h"
+#include "dedup.h"
+
+/*------------------------------------------------------------------------------
+		definitions (defines, typedefs, ...)
+------------------------------------------------------------------------------*/
+#define LINE_MAX_LENGTH 512
+
+#ifdef LOG_BINARY
+  #define DEFAULT_LOG_FORMAT LOG_FORMAT_BINARY
+#else
+  #define DEFAULT_LOG_FORMAT LOG_FORMAT_TEXT
+#endif
+
+#ifdef LOG_SHM_RING
+  #define DEFAULT_LOG_TRANSPORT LOG_TRANSPORT_RING
+#else
+  #define DEFAULT_LOG_TRANSPORT LOG_TRANSPORT_FIFO
+#endif
+
+typedef enum{ OPT_INT, OPT_LONG, OPT_DOUBLE, OPT_STRING, OPT_ENUM, OPT_FLAGS, OPT_ROOMS } option_type_t;
+
+typedef struct{
+  const char *       key;
+  option_type_t     type;
+  size_t               offset;
+  const char *       choices[5];     // OPT_ENUM: value names in enum order, OPT_FLAGS: names of bit 0, 1, ..., NULL terminated
+}option_t;
+
+#define OPTION(key, type, ...) { #key, type, offsetof(gateway_config_t, key), { __VA_ARGS__ } }
+
+/*------------------------------------------------------------------------------
+		global variable declarations
+------------------------------------------------------------------------------*/
+gateway_config_t gw_config = {
+  .max_temp                = SET_MAX_TEMP,
+  .min_temp                 = SET_MIN_TEMP,
+  .room_max_temp       = SET_ROOM_MAX_TEMP,
+  .room_min_temp        = SET_ROOM_MIN_TEMP,
+  .alarm_hysteresis     = ALARM_HYSTERESIS,
+  .alarm_dwell            = ALARM_DWELL,
+  .alarm_reminder       = ALARM_REMINDER,
+  .run_avg_length        = RUN_AVG_LENGTH,
+  .window_seconds      = WINDOW_SECONDS,
+  .reorder_depth         = REORDER_DEPTH,
+  .reorder_window       = REORDER_WINDOW,
+  .aggregates            = DATAMGR_AGGREGATES,
+  .ewma_alpha           = EWMA_ALPHA,
+  .sensor_map            = SENSOR_MAP_NAME,
+  .map_reload_interval = MAP_RELOAD_INTERVAL,
+  .provisional_sensors = PROVISIONAL_SENSORS,
+  .silence_timeout      = SILENCE_TIMEOUT,
+  .flatline_timeout      = FLATLINE_TIMEOUT,
+  .datamgr_workers    = DATAMGR_WORKERS,
+  .timeout                  = TIMEOUT,
+  .dedup_horizon         = DEDUP_HORIZON,
+  .db_name                = TO_STRING(DB_NAME),
+  .storage_batch_size  = STORAGE_BATCH_SIZE,
+  .storage_linger_ms   = STORAGE_LINGER_MS,
+  .import_batch_size   = IMPORT_BATCH_SIZE,
+  .db_profile             = DB_PROFILE,
+  .db_page_size         = DB_PAGE_SIZE,
+  .db_cache_kib         = DB_CACHE_KIB,
+  .db_mmap_size        = DB_MMAP_SIZE,
+  .db_checkpoint_pages = DB_CHECKPOINT_PAGES,
+  .db_checkpoint_interval = DB_CHECKPOINT_INTERVAL,
+  .log_format             = DEFAULT_LOG_FORMAT,
+  .log_transport          = DEFAULT_LOG_TRANSPORT,
+  .fifo_name              = FIFO_NAME,
+  .log_file                 = LOG_FILE_NAME,
+  .log_bin_file            = LOG_BIN_FILE_NAME,
+  .log_ring_slots         = LOG_RING_SLOTS,
+  .log_rotate_size       = LOG_ROTATE_SIZE,
+  .log_rotate_interval  = LOG_ROTATE_INTERVAL,
+  .log_retain              = LOG_RETAIN,
+  .log_rate_burst         = LOG_RATE_BURST,
+  .log_rate_per_minute = LOG_RATE_PER_MINUTE,
+  .log_summary_period = LOG_SUMMARY_PERIOD,
+};
+
+static const option_t options[] = {
+  OPTION(max_temp,             OPT_DOUBLE),
+  OPTION(min_temp,              OPT_DOUBLE),
+  OPTION(room_max_temp,     OPT_DOUBLE),
+  OPTION(room_min_temp,      OPT_DOUBLE),
+  OPTION(alarm_hysteresis,  OPT_DOUBLE),
+  OPTION(alarm_dwell,          OPT_INT),
+  OPTION(alarm_reminder,     OPT_INT),
+  OPTION(run_avg_length,     OPT_INT),
+  OPTION(window_seconds,    OPT_INT),
+  OPTION(reorder_depth,     OPT_INT),
+  OPTION(reorder_window,   OPT_INT),
+  OPTION(aggregates,         OPT_FLAGS, "ewma", "minmax", "variance", "rate", NULL),
+  OPTION(ewma_alpha,         OPT_DOUBLE),
+  OPTION(sensor_map,         OPT_STRING),
+  OPTION(map_reload_interval, OPT_INT),
+  OPTION(provisional_sensors, OPT_INT),
+  OPTION(silence_timeout,   OPT_INT),
+  OPTION(flatline_timeout,   OPT_INT),
+  OPTION(room_silence_timeout, OPT_ROOMS),
+  OPTION(room_flatline_timeout, OPT_ROOMS),
+  OPTION(datamgr_workers,  OPT_INT),
+  OPTION(timeout,               OPT_INT),
+  OPTION(dedup_horizon,      OPT_INT),
+  OPTION(db_name,             OPT_STRING),
+  OPTION(storage_batch_size, OPT_INT),
+  OPTION(storage_linger_ms, OPT_INT),
+  OPTION(import_batch_size, OPT_INT),
+  OPTION(db_profile,           OPT_ENUM, "legacy", "safe", "normal", "fast", NULL),
+  OPTION(db_page_size,       OPT_INT),
+  OPTION(db_cache_kib,       OPT_INT),
+  OPTION(db_mmap_size,      OPT_LONG),
+  OPTION(db_checkpoint_pages, OPT_INT),
+  OPTION(db_checkpoint_interval, OPT_INT),
+  OPTION(log_format,          OPT_ENUM, "text", "binary", NULL),
+  OPTION(log_transport,       OPT_ENUM, "fifo", "ring", NULL),
+  OPTION(fifo_name,           OPT_STRING),
+  OPTION(log_file,              OPT_STRING),
+  OPTION(log_bin_file,         OPT_STRING),
+  OPTION(log_ring_slots,      OPT_INT),
+  OPTION(log_rotate_size,    OPT_LONG),
+  OPTION(log_rotate_interval, OPT_INT),
+  OPTION(log_retain,           OPT_INT),
+  OPTION(log_rate_burst,      OPT_INT),
+  OPTION(log_rate_per_minute, OPT_INT),
+  OPTION(log_summary_period, OPT_INT),
+};
+
+#define NUM_OPTIONS (sizeof(options) / sizeof(options[0]))
+
+/*------------------------------------------------------------------------------
+		implementation code
+------------------------------------------------------------------------------*/
+static char * trim(char * s){
+  char * end;
+  while(isspace((unsigned char)*s))s++;
+  end = s + strlen(s);
+  while(end > s && isspace((unsigned char)end[-1]))end--;
+  *end = '\0';
+  return s;
+}
+
+int gwconfig_set(const char * key, const char * value){
+  const option_t * opt = NULL;
+  char * end;
+  size_t i;
+
+  for(i = 0; i != NUM_OPTIONS; i++){
+    if(strcmp(options[i].key, key) == 0){
+      opt = &options[i];
+      break;
+    }
+  }
+  if(opt == NULL){
+    fprintf(stderr, "Unknown configuration key '%s'\n", key);
+    return -1;
+  }
+
+  void * field = (char *)&gw_config + opt->offset;
+  errno = 0;
+  switch(opt->type){
+    case OPT_INT:{
+      long v = strtol(value, &end, 10);
+      if(errno != 0 || end == value || *end != '\0' || v < 0 || v > INT32_MAX)goto invalid;
+      *(int *)field = (int)v;
+      break;
+    }
+    case OPT_LONG:{
+      long v = strtol(value, &end, 10);
+      if(errno != 0 || end == value || *end != '\0' || v < 0)goto invalid;
+      *(long *)field = v;
+      break;
+    }
+    case OPT_DOUBLE:{
+      double v = strtod(value, &end);
+      if(errno != 0 || end == value || *end != '\0')goto invalid;
+      *(double *)field = v;
+      break;
+    }
+    case OPT_STRING:{
+      /* the defaults are string literals, so replaced values are never freed */
+      char * v = strdup(value);
+      if(v == NULL || *v == '\0')goto invalid;
+      *(char **)field = v;
+      break;
+    }
+    case OPT_ENUM:{
+      int c;
+      for(c = 0; opt->choices[c] != NULL; c++){
+        if(strcmp(opt->choices[c], value) == 0)break;
+      }
+      if(opt->choices[c] == NULL)goto invalid;
+      *(int *)field = c;
+      break;
+    }
+    case OPT_FLAGS:{
+      /* comma separated names, or "none" */
+      char * list = strdup(value), * save = NULL, * name;
+      int c, flags = 0;
+      if(list == NULL)goto invalid;
+      for(name = strtok_r(list, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)){
+        name = trim(name);
+        if(strcmp(name, "none") == 0)continue;
+        for(c = 0; opt->choices[c] != NULL; c++){
+          if(strcmp(opt->choices[c], name) == 0)break;
+        }
+        if(opt->choices[c] == NULL){
+          free(list);
+          goto invalid;
+        }
+        flags |= 1 << c;
+      }
+      free(list);
+      *(int *)field = flags;
+      break;
+    }
+    case OPT_ROOMS:{
+      /* comma separated room:seconds pairs, or "none" */
+      room_limits_t limits = { 0, NULL };
+      char * list = strdup(value), * save = NULL, * item;
+      if(list == NULL)goto invalid;
+      for(item = strtok_r(list, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)){
+        unsigned long room;
+        long seconds;
+        item = trim(item);
+        if(strcmp(item, "none") == 0)continue;
+        room = strtoul(item, &end, 10);
+        if(end == item || *end != ':' || room > UINT16_MAX)goto invalid_rooms;
+        item = end + 1;
+        seconds = strtol(item, &end, 10);
+        if(errno != 0 || end == item || *end != '\0' || seconds < 0 || seconds > INT32_MAX)goto invalid_rooms;
+        room_limit_t * items = realloc(limits.items, (limits.count + 1) * sizeof(room_limit_t));
+        if(items == NULL)goto invalid_rooms;
+        limits.items = items;
+        limits.items[limits.count++] = (room_limit_t){ (uint16_t)room, (int)seconds };
+      }
+      free(list);
+      free(((room_limits_t *)field)->items);
+      *(room_limits_t *)field = limits;
+      break;
+invalid_rooms:
+      free(limits.items);
+      free(list);
+      goto invalid;
+    }
+  }
+  return 0;
+
+invalid:
+  fprintf(stderr, "Invalid value '%s' for configuration key '%s'\n", value, key);
+  return -1;
+}
+
+int gwconfig_load(const char * path){
+  char line[LINE_MAX_LENGTH];
+  int line_nr = 0, result = 0;
+  FILE * fp_config = fopen(path, "r");
+  if(fp_config == NULL){
+    fprintf(stderr, "Can't open configuration file %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  while(fgets(line, sizeof(line), fp_config) != NULL){
+    char *key, *value, *comment, *eq;
+    line_nr++;
+    comment = strchr(line, '#');
+    if(comment != NULL)*comment = '\0';
+    key = trim(line);
+    if(*key == '\0')continue;
+
+    eq = strchr(key, '=');
+    if(eq == NULL){
+      fprintf(stderr, "%s:%d: expected 'key = value'\n", path, line_nr);
+      result = -1;
+      continue;
+    }
+    *eq = '\0';
+    value = trim(eq + 1);
+    key = trim(key);
+    if(gwconfig_set(key, value) == -1){
+      fprintf(stderr, "%s:%d: line ignored\n", path, line_nr);
+      result = -1;
+    }
+  }
+  fclose(fp_config);
+  return result;
+}
+
+int gwconfig_override(const char * assignment){
+  char * copy = strdup(assignment), *eq;
+  int result;
+  if(copy == NULL)return -1;
+  eq = strchr(copy, '=');
+  if(eq == NULL){
+    fprintf(stderr, "Expected key=value instead of '%s'\n", assignment);
+    free(copy);
+    return -1;
+  }
+  *eq = '\0';
+  result = gwconfig_set(trim(copy), trim(eq + 1));
+  free(copy);
+  return result;
+}
+
+int gwconfig_validate(void){
+  int result = 0;
+  if(gw_config.min_temp >= gw_config.max_temp){
+    fprintf(stderr, "min_temp (%g) must be below max_temp (%g)\n", gw_config.min_temp, gw_config.max_temp);
+    result = -1;
+  }
+  /* unset room thresholds follow the sensor thresholds as they were finally configured */
+  if(isnan(gw_config.room_max_temp))gw_config.room_max_temp = gw_config.max_temp;
+  if(isnan(gw_config.room_min_temp))gw_config.room_min_temp = gw_config.min_temp;
+  if(gw_config.room_min_temp >= gw_config.room_max_temp){
+    fprintf(stderr, "room_min_temp (%g) must be below room_max_temp (%g)\n", gw_config.room_min_temp, gw_config.room_max_temp);
+    result = -1;
+  }
+  if(gw_config.alarm_hysteresis < 0){
+    fprintf(stderr, "alarm_hysteresis can't be negative\n");
+    result = -1;
+  }
+  if(gw_config.run_avg_length < 1){
+    fprintf(stderr, "run_avg_length must be at least 1\n");
+    result = -1;
+  }
+  if(gw_config.reorder_depth > REORDER_MAX_DEPTH){
+    fprintf(stderr, "reorder_depth can't be more than %d\n", REORDER_MAX_DEPTH);
+    result = -1;
+  }
+  if(!(gw_config.ewma_alpha > 0 && gw_config.ewma_alpha <= 1)){
+    fprintf(stderr, "ewma_alpha must be in (0, 1]\n");
+    result = -1;
+  }
+  if(gw_config.datamgr_workers < 1 || gw_config.datamgr_workers > DATAMGR_MAX_WORKERS){
+    fprintf(stderr, "datamgr_workers must be between 1 and %d\n", DATAMGR_MAX_WORKERS);
+    result = -1;
+  }
+  if(gw_config.provisional_sensors < 0 || gw_config.provisional_sensors > UINT16_MAX + 1){
+    fprintf(stderr, "provisional_sensors must be between 0 and %d\n", UINT16_MAX + 1);
+    result = -1;
+  }
+  if(gw_config.timeout < 1){
+    fprintf(stderr, "timeout must be at least 1 second\n");
+    result = -1;
+  }
+  if(gw_config.import_batch_size < 1){
+    fprintf(stderr, "import_batch_size must be at least 1\n");
+    result = -1;
+  }
+  if(gw_config.storage_batch_size < 1){
+    fprintf(stderr, "storage_batch_size must be at least 1\n");
+    result = -1;
+  }
+  if(gw_config.db_page_size < 512 || gw_config.db_page_size > 65536 || (gw_config.db_page_size & (gw_config.db_page_size - 1)) != 0){
+    fprintf(stderr, "db_page_size must be a power of 2 from 512 to 65536\n");
+    result = -1;
+  }
+  if(gw_config.db_checkpoint_pages < 1){
+    fprintf(stderr, "db_checkpoint_pages must be at least 1\n");
+    result = -1;
+  }
+  if(gw_config.log_ring_slots < 2){
+    fprintf(stderr, "log_ring_slots must be at least 2\n");
+    result = -1;
+  }
+  return result;
+}
+
+void gwconfig_print(FILE * out){
+  size_t i;
+  for(i = 0; i != NUM_OPTIONS; i++){
+    const void * field = (const char *)&gw_config + options[i].offset;
+    fprintf(out, "%s = ", options[i].key);
+    switch(options[i].type){
+      case OPT_INT:    fprintf(out, "%d\n", *(const int *)field); break;
+      case OPT_LONG:   fprintf(out, "%ld\n", *(const long *)field); break;
+      case OPT_DOUBLE:
+        if(isnan(*(const double *)field))fprintf(out, "unset\n");
+        else fprintf(out, "%g\n", *(const double *)field);
+        break;
+      case OPT_STRING: fprintf(out, "%s\n", *(char * const *)field); break;
+      case OPT_ENUM:   fprintf(out, "%s\n", options[i].choices[*(const int *)field]); break;
+      case OPT_FLAGS:{
+        int c, flags = *(const int *)field;
+        const char * sep = "";
+        if(flags == 0)fprintf(out, "none");
+        for(c = 0; options[i].choices[c] != NULL; c++){
+          if(flags & (1 << c)){
+            fprintf(out, "%s%s", sep, options[i].choices[c]);
+            sep = ",";
+          }
+        }
+        fprintf(out, "\n");
+        break;
+      }
+      case OPT_ROOMS:{
+        const room_limits_t * limits = field;
+        int c;
+        if(limits->count == 0)fprintf(out, "none");
+        for(c = 0; c != limits->count; c++){
+          fprintf(out, "%s%u:%d", c ? "," : "", limits->items[c].room, limits->items[c].seconds);
+        }
+        fprintf(out, "\n");
+        break;
+      }
+    }
+  }
+}
@@ -0,0 +1,130 @@
+#ifndef _GWCONFIG_H_
+#define _GWCONFIG_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Compile time defaults of the settings that have no other home
+ * (module specific defaults such as SET_MAX_TEMP or LOG_RETAIN live in the module headers)
+ */
+#ifndef SENSOR_MAP_NAME
+  #define SENSOR_MAP_NAME "room_sensor.map"
+#endif
+
+#ifndef FIFO_NAME
+  #define FIFO_NAME "logFifo"
+#endif
+
+#ifndef LOG_FILE_NAME
+  #define LOG_FILE_NAME "gateway.log"
+#endif
+
+#ifndef LOG_BIN_FILE_NAME
+  #define LOG_BIN_FILE_NAME "gateway.bin"
+#endif
+
+typedef enum{ LOG_FORMAT_TEXT = 0, LOG_FORMAT_BINARY } log_format_t;
+typedef enum{ LOG_TRANSPORT_FIFO = 0, LOG_TRANSPORT_RING } log_transport_t;
+typedef enum{ DB_PROFILE_LEGACY = 0, DB_PROFILE_SAFE, DB_PROFILE_NORMAL, DB_PROFILE_FAST } db_profile_t;
+
+/* per room values of a setting, written as 'room:seconds,room:seconds' or 'none' */
+typedef struct{
+  uint16_t          room;
+  int                  seconds;
+}room_limit_t;
+
+typedef struct{
+  int                  count;
+  room_limit_t *   items;
+}room_limits_t;
+
+typedef struct{
+  /* datamgr */
+  double             max_temp;
+  double             min_temp;
+  double             room_max_temp;
+  double             room_min_temp;
+  double             alarm_hysteresis;
+  int                  alarm_dwell;
+  int                  alarm_reminder;
+  int                  run_avg_length;
+  int                  window_seconds;      // 0: the running average covers run_avg_length readings
+  int                  reorder_depth;        // 0: readings are aggregated in arrival order
+  int                  reorder_window;
+  int                  aggregates;             // AGG_* flags of the statistics kept per sensor
+  double             ewma_alpha;
+  char *              sensor_map;
+  int                  map_reload_interval; // 0: the sensor map is only reloaded on SIGHUP
+  int                  provisional_sensors;  // capacity of the table of sensors that are not in the map
+  int                  silence_timeout;       // seconds without a reading before a sensor is reported silent, 0 = off
+  int                  flatline_timeout;      // seconds of readings with one unchanged value before a sensor is reported stuck, 0 = off
+  room_limits_t    room_silence_timeout; // overrides of silence_timeout for the sensors of a room
+  room_limits_t    room_flatline_timeout;
+  int                  datamgr_workers;
+  /* connmgr and the blocking buffer reads */
+  int                  timeout;
+  int                  dedup_horizon;         // 0: retransmitted readings are not filtered
+  /* storagemgr */
+  char *              db_name;
+  int                  storage_batch_size;
+  int                  storage_linger_ms;
+  int                  import_batch_size;     // rows per transaction of insert_sensor_from_file
+  db_profile_t     db_profile;              // journal and sync mode, see DB_PROFILE in sensor_db.h
+  int                  db_page_size;
+  int                  db_cache_kib;
+  long                db_mmap_size;
+  int                  db_checkpoint_pages;  // uncopied WAL pages that wake the checkpointer
+  int                  db_checkpoint_interval;
+  /* log process */
+  log_format_t     log_format;
+  log_transport_t log_transport;
+  char *              fifo_name;
+  char *              log_file;
+  char *              log_bin_file;
+  int                  log_ring_slots;
+  long                log_rotate_size;
+  int                  log_rotate_interval;
+  int                  log_retain;
+  int                  log_rate_burst;
+  int                  log_rate_per_minute;
+  int                  log_summary_period;
+}gateway_config_t;
+
+/*
+ * The active configuration, holding the compile time defaults until gwconfig_load / gwconfig_set change it
+ * Load it before fork() and before any thread starts, it is read-only afterwards
+ */
+extern gateway_config_t gw_config;
+
+/*
+ * Reads 'key = value' lines from 'path' ('#' starts a comment) and applies them with gwconfig_set
+ * Returns 0 on success, -1 if the file can't be read or contains an invalid line (reported on stderr)
+ */
+int gwconfig_load(const char * path);
+
+/*
+ * Sets one configuration key from its textual value, e.g. gwconfig_set("max_temp", "22.5")
+ * Returns 0 on success, -1 for an unknown key or a malformed value (reported on stderr)
+ */
+int gwconfig_set(const char * key, const char * value);
+
+/*
+ * Applies a 'key=value' command line override
+ * Returns 0 on success, -1 if an error occurs
+ */
+int gwconfig_override(const char * assignment);
+
+/*
+ * Checks the consistency of the active configuration
+ * Returns 0 if it is usable, -1 otherwise (reported on stderr)
+ */
+int gwconfig_validate(void);
+
+/*
+ * Prints all keys with their current values
+ */
+void gwconfig_print(FILE * out);
+
+#endif /* _GWCONFIG_H_ */
@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+/*-----------------------------------------------------------------------------
+		include files
+------------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "errmacros.h"
+#include "config.h"
+#include "logevent.h"
+#include "logfile.h"
+
+/*------------------------------------------------------------------------------
+		definitions (defines, typedefs, ...)
+------------------------------------------------------------------------------*/
+typedef struct{
+  bool               by_sensor;
+  sensor_id_t     sensor_id;
+  bool               by_type;
+  uint16_t          type;
+  int64_t            from;
+  int64_t            to;
+}log_filter_t;
+
+/*------------------------------------------------------------------------------
+		function declarations
+------------------------------------------------------------------------------*/
+void       print_help               (void);
+uint32_t  find_start_record   (const char * path, int64_t from);
+bool       match_filter           (const log_filter_t * filter, const log_event_t * ev);
+
+/*------------------------------------------------------------------------------
+		implementation code
+------------------------------------------------------------------------------*/
+int main( int argc, char *argv[] ){
+  log_filter_t filter = { .from = INT64_MIN, .to = INT64_MAX };
+  log_file_header_t header;
+  log_event_t ev;
+  char msg[LOG_MSG_MAX];
+  uint32_t start;
+  gzFile fp_log;
+  int opt;
+
+  while((opt = getopt(argc, argv, "s:f:t:e:h")) != -1){
+    switch(opt){
+      case 's':
+        filter.by_sensor = true;
+        filter.sensor_id = (sensor_id_t)atoi(optarg);
+        break;
+      case 'f':
+        filter.from = strtoll(optarg, NULL, 10);
+        break;
+      case 't':
+        filter.to = strtoll(optarg, NULL, 10);
+        break;
+      case 'e':
+        filter.by_type = true;
+        filter.type = log_event_type_from_name(optarg);
+        if(filter.type == LOG_EV_NONE){
+          fprintf(stderr, "Unknown event type %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      default:
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+  }
+  if(optind != argc - 1){
+    print_help();
+    exit(EXIT_FAILURE);
+  }
+
+  /* rotated segments are gzip compressed, gzread reads plain files as they are */
+  fp_log = gzopen(argv[optind], "rb");
+  FILE_OPEN_ERROR(fp_log);
+
+  if(gzread(fp_log, &header, sizeof(header)) != sizeof(header) || header.magic != LOG_FILE_MAGIC){
+    fprintf(stderr, "%s is not a binary gateway log\n", argv[optind]);
+    exit(EXIT_FAILURE);
+  }
+  if(header.version != LOG_FILE_VERSION || header.record_size != sizeof(log_event_t)){
+    fprintf(stderr, "%s: unsupported log version %" PRIu16 " (record size %" PRIu16 ")\n", argv[optind], header.version, header.record_size);
+    exit(EXIT_FAILURE);
+  }
+
+  /* the log process stamps records in order, so the scan can start at the last index entry before 'from' */
+  start = find_start_record(argv[optind], filter.from);
+  if(gzseek(fp_log, sizeof(header) + (z_off_t)start * sizeof(log_event_t), SEEK_SET) == -1){
+    perror("gzseek failed");
+    exit(EXIT_FAILURE);
+  }
+
+  while(gzread(fp_log, &ev, sizeof(ev)) == sizeof(ev)){
+    if(ev.ts > filter.to)break;
+    if(!match_filter(&filter, &ev))continue;
+    log_event_format(&ev, msg, sizeof(msg));
+    printf("%" PRIu32 " %" PRId64 " %s\n", ev.seq, ev.ts, msg);
+  }
+
+  FILE_CLOSE_ERROR(gzclose(fp_log) == Z_OK ? 0 : -1);
+  return EXIT_SUCCESS;
+}
+
+/*
+ * Returns the record number of the last sparse index entry with a timestamp before 'from',
+ * or 0 if there is no index or no such entry. The index of a compressed segment is not compressed
+ */
+uint32_t find_start_record(const char * path, int64_t from){
+  log_index_entry_t * entries;
+  char * index_path;
+  FILE * fp_index;
+  long size;
+  size_t count, lo, hi;
+  uint32_t record = 0;
+
+  if(from == INT64_MIN)return 0;
+
+  size_t len = strlen(path);
+  if(len > strlen(LOG_SEGMENT_SUFFIX) && strcmp(path + len - strlen(LOG_SEGMENT_SUFFIX), LOG_SEGMENT_SUFFIX) == 0){
+    len -= strlen(LOG_SEGMENT_SUFFIX);
+  }
+  ASPRINTF_ERROR(asprintf(&index_path, "%.*s%s", (int)len, path, LOG_INDEX_SUFFIX));
+  fp_index = fopen(index_path, "r");
+  free(index_path);
+  if(fp_index == NULL)return 0;
+
+  fseek(fp_index, 0, SEEK_END);
+  size = ftell(fp_index);
+  rewind(fp_index);
+  count = size / sizeof(log_index_entry_t);
+  entries = malloc(count * sizeof(log_index_entry_t) + 1);
+  if(entries == NULL || fread(entries, sizeof(log_index_entry_t), count, fp_index) != count){
+    free(entries);
+    fclose(fp_index);
+    return 0;
+  }
+  fclose(fp_index);
+
+  /* binary search for the first entry with ts >= from, then step back one */
+  lo = 0;
+  hi = count;
+  while(lo < hi){
+    size_t mid = lo + (hi - lo) / 2;
+    if(entries[mid].ts < from)lo = mid + 1;
+    else hi = mid;
+  }
+  if(lo > 0)record = entries[lo - 1].record;
+
+  free(entries);
+  return record;
+}
+
+bool match_filter(const log_filter_t * filter, const log_event_t * ev){
+  if(ev->ts < filter->from)return false;
+  if(filter->by_sensor && ev->sensor_id != filter->sensor_id)return false;
+  if(filter->by_type && ev->type != filter->type)return false;
+  return true;
+}
+
+void print_help(void)
+{
+  printf("Use this program to decode a binary gateway log: logdecode [options] <gateway.bin | rotated segment .gz>\n");
+  printf("\t%-15s : only show events of this sensor id\n", "-s sensor_id");
+  printf("\t%-15s : only show events logged at or after this UTC timestamp\n", "-f from");
+  printf("\t%-15s : only show events logged at or before this UTC timestamp\n", "-t to");
+  printf("\t%-15s : only show events of this type (conn_open, too_hot, ...)\n", "-e type");
+}
@@ -0,0 +1,322 @@
+#define _GNU_SOURCE
+/*-----------------------------------------------------------------------------
+		include files
+------------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "logevent.h"
+#include "logring.h"
+#include "lograte.h"
+#include "errmacros.h"
+
+/*------------------------------------------------------------------------------
+		global variable declarations
+------------------------------------------------------------------------------*/
+static FILE *        log_fifo = NULL;
+static sem_t *      log_sem = NULL;
+static logring_t * log_ring = NULL;
+/* summary thread, so suppressed events are reported even when no further event is logged */
+static pthread_t           summary_thread;
+static pthread_mutex_t   summary_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    summary_cond = PTHREAD_COND_INITIALIZER;
+static bool                  summary_running = false;
+static bool                  summary_stop = false;
+
+#define SUMMARY_BATCH 32
+
+static const char * const type_names[LOG_EV_TYPE_COUNT] = {
+  [LOG_EV_NONE]             = "none",
+  [LOG_EV_CONN_OPEN]        = "conn_open",
+  [LOG_EV_CONN_CLOSE]       = "conn_close",
+  [LOG_EV_SENSOR_INVALID]   = "sensor_invalid",
+  [LOG_EV_TOO_HOT]          = "too_hot",
+  [LOG_EV_TOO_COLD]         = "too_cold",
+  [LOG_EV_DB_CONNECTED]     = "db_connected",
+  [LOG_EV_DB_LOST]          = "db_lost",
+  [LOG_EV_DB_UNREACHABLE]   = "db_unreachable",
+  [LOG_EV_DB_TABLE_CREATED] = "db_table_created",
+  [LOG_EV_EVENTS_DROPPED]   = "events_dropped",
+  [LOG_EV_SUPPRESSED]       = "suppressed",
+  [LOG_EV_ROOM_TOO_HOT]     = "room_too_hot",
+  [LOG_EV_ROOM_TOO_COLD]    = "room_too_cold",
+  [LOG_EV_TEMP_NORMAL]      = "temp_normal",
+  [LOG_EV_ROOM_NORMAL]      = "room_normal",
+  [LOG_EV_MAP_RELOADED]     = "map_reloaded",
+  [LOG_EV_SENSOR_PROVISIONAL] = "sensor_provisional",
+  [LOG_EV_SENSOR_SILENT]    = "sensor_silent",
+  [LOG_EV_SENSOR_STUCK]     = "sensor_stuck",
+  [LOG_EV_SENSOR_RESUMED]   = "sensor_resumed",
+  [LOG_EV_SENSOR_UNSTUCK]   = "sensor_unstuck",
+  [LOG_EV_DUPLICATES_DROPPED] = "duplicates_dropped",
+};
+
+/*------------------------------------------------------------------------------
+		implementation code
+------------------------------------------------------------------------------*/
+void log_event_attach_fifo(FILE * fifo, sem_t * sema){
+  log_fifo = fifo;
+  log_sem = sema;
+}
+
+void log_event_attach_ring(logring_t * ring){
+  log_ring = ring;
+}
+
+/* the record is smaller than PIPE_BUF, so a single flushed fwrite reaches the reader unsplit */
+static void send_event(const log_event_t * ev){
+  int presult;
+
+  if(log_ring != NULL){
+    logring_push(log_ring, ev);
+    return;
+  }
+
+  presult = sem_wait( log_sem );
+  ERROR_HANDLER(presult);
+
+  if ( fwrite( ev, sizeof(*ev), 1, log_fifo ) != 1 )
+  {
+    fprintf( stderr, "Error writing data to fifo.\n");
+    exit( EXIT_FAILURE );
+  }
+  FFLUSH_ERROR(fflush(log_fifo));
+  DEBUG_PRINT("Event %s send to fifo\n", log_event_type_name(ev->type));
+
+  presult = sem_post( log_sem );
+  ERROR_HANDLER(presult);
+}
+
+static void send_summaries(bool all){
+  log_event_t summaries[SUMMARY_BATCH];
+  int i, count;
+  do{
+    count = lograte_collect(summaries, SUMMARY_BATCH, all);
+    for(i = 0; i != count; i++)send_event(&summaries[i]);
+  }while(count == SUMMARY_BATCH);
+}
+
+void log_event(log_event_type_t type, sensor_id_t sensor_id, double value){
+  log_event_t ev = { .type = type, .sensor_id = sensor_id, .value = value };
+
+  if(log_ring == NULL && log_fifo == NULL)return;
+  if(!lograte_admit(type, sensor_id))return;
+  send_event(&ev);
+}
+
+/* wakes every lograte_sweep_interval() seconds and sends the summaries whose period has ended */
+static void * summary_sender(void * arg){
+  struct timespec deadline;
+  double interval = lograte_sweep_interval();
+  int presult;
+
+  presult = pthread_mutex_lock(&summary_lock);
+  ERROR_HANDLER(presult);
+  while(!summary_stop){
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t)interval;
+    deadline.tv_nsec += (long)((interval - (time_t)interval) * 1e9);
+    if(deadline.tv_nsec >= 1000000000L){
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&summary_cond, &summary_lock, &deadline);
+    if(summary_stop)break;
+    if(!lograte_summary_due())continue;
+
+    /* sending may block on the FIFO, log_event_flush_summaries must not wait for that to take the lock */
+    presult = pthread_mutex_unlock(&summary_lock);
+    ERROR_HANDLER(presult);
+    send_summaries(false);
+    presult = pthread_mutex_lock(&summary_lock);
+    ERROR_HANDLER(presult);
+  }
+  presult = pthread_mutex_unlock(&summary_lock);
+  ERROR_HANDLER(presult);
+  return NULL;
+}
+
+void log_event_start_summaries(void){
+  int presult;
+
+  if(summary_running || (log_ring == NULL && log_fifo == NULL))return;
+  summary_stop = false;
+  presult = pthread_create(&summary_thread, NULL, &summary_sender, NULL);
+  ERROR_HANDLER(presult);
+  summary_running = true;
+}
+
+void log_event_flush_summaries(void){
+  int presult;
+
+  if(log_ring == NULL && log_fifo == NULL)return;
+  if(summary_running){
+    presult = pthread_mutex_lock(&summary_lock);
+    ERROR_HANDLER(presult);
+    summary_stop = true;
+    presult = pthread_cond_signal(&summary_cond);
+    ERROR_HANDLER(presult);
+    presult = pthread_mutex_unlock(&summary_lock);
+    ERROR_HANDLER(presult);
+    presult = pthread_join(summary_thread, NULL);
+    ERROR_HANDLER(presult);
+    summary_running = false;
+  }
+  send_summaries(true);
+}
+
+int log_event_read(FILE * fifo, log_event_t * ev){
+  return fread( ev, sizeof(*ev), 1, fifo ) == 1;
+}
+
+int log_event_format(const log_event_t * ev, char * buf, size_t len){
+  switch(ev->type){
+    case LOG_EV_CONN_OPEN:
+      return snprintf(buf, len, "A sensor node with %" PRIu16 " has opened a new connection", ev->sensor_id);
+    case LOG_EV_CONN_CLOSE:
+      return snprintf(buf, len, "A sensor node with %" PRIu16 " has closed the connection", ev->sensor_id);
+    case LOG_EV_SENSOR_INVALID:
+      return snprintf(buf, len, "Received sensor data with invalid sensor node ID %" PRIu16, ev->sensor_id);
+    case LOG_EV_TOO_HOT:
+      return snprintf(buf, len, "The sensor node with %" PRIu16 " reports it's too hot (running avg temperature = %g)", ev->sensor_id, ev->value);
+    case LOG_EV_TOO_COLD:
+      return snprintf(buf, len, "The sensor node with %" PRIu16 " reports it's too cold (running avg temperature = %g)", ev->sensor_id, ev->value);
+    case LOG_EV_ROOM_TOO_HOT:
+      return snprintf(buf, len, "The room with %" PRIu16 " reports it's too hot (avg temperature = %g)", ev->sensor_id, ev->value);
+    case LOG_EV_ROOM_TOO_COLD:
+      return snprintf(buf, len, "The room with %" PRIu16 " reports it's too cold (avg temperature = %g)", ev->sensor_id, ev->value);
+    case LOG_EV_TEMP_NORMAL:
+      return snprintf(buf, len, "The sensor node with %" PRIu16 " is back to normal (running avg temperature = %g)", ev->sensor_id, ev->value);
+    case LOG_EV_ROOM_NORMAL:
+      return snprintf(buf, len, "The room with %" PRIu16 " is back to normal (avg temperature = %g)", ev->sensor_id, ev->value);
+    case LOG_EV_SENSOR_PROVISIONAL:
+      return snprintf(buf, len, "Sensor node %" PRIu16 " is not in the sensor map, tracking it provisionally", ev->sensor_id);
+    case LOG_EV_MAP_RELOADED:
+      return snprintf(buf, len, "Sensor map reloaded with %g sensors", ev->value);
+    case LOG_EV_SENSOR_SILENT:
+      return snprintf(buf, len, "Sensor node %" PRIu16 " is silent (no reading for %.0f seconds)", ev->sensor_id, ev->value);
+    case LOG_EV_SENSOR_STUCK:
+      return snprintf(buf, len, "Sensor node %" PRIu16 " looks stuck (keeps reporting %g)", ev->sensor_id, ev->value);
+    case LOG_EV_SENSOR_RESUMED:
+      return snprintf(buf, len, "Sensor node %" PRIu16 " reports again", ev->sensor_id);
+    case LOG_EV_SENSOR_UNSTUCK:
+      return snprintf(buf, len, "Sensor node %" PRIu16 " is no longer stuck (new value %g)", ev->sensor_id, ev->value);
+    case LOG_EV_DUPLICATES_DROPPED:
+      return snprintf(buf, len, "Dropped %.0f duplicate readings of sensor node %" PRIu16, ev->value, ev->sensor_id);
+    case LOG_EV_DB_CONNECTED:
+      return snprintf(buf, len, "Connection to SQL server established.");
+    case LOG_EV_DB_LOST:
+      return snprintf(buf, len, "Connection to SQL server lost");
+    case LOG_EV_DB_UNREACHABLE:
+      return snprintf(buf, len, "Unable to connect to SQL server");
+    case LOG_EV_DB_TABLE_CREATED:
+      return snprintf(buf, len, "New table SensorData created.");
+    case LOG_EV_SUPPRESSED:
+      return snprintf(buf, len, "Sensor node %" PRIu16 " %s x %.0f in last %" PRIu32 "s (suppressed)",
+                      ev->sensor_id, log_event_type_name(ev->arg & 0xffff), ev->value, ev->arg >> 16);
+    case LOG_EV_EVENTS_DROPPED:
+      return snprintf(buf, len, "%.0f log events dropped because the log ring was full", ev->value);
+    default:
+      return snprintf(buf, len, "Unknown event type %" PRIu16 " (sensor %" PRIu16 ", value %g)", ev->type, ev->sensor_id, ev->value);
+  }
+}
+
+const char * log_event_type_name(uint16_t type){
+  if(type >= LOG_EV_TYPE_COUNT)return "unknown";
+  return type_names[type];
+}
+
+log_event_type_t log_event_type_from_name(const char * name){
+  int i;
+  for(i = 1; i != LOG_EV_TYPE_COUNT; i++){
+    if(strcmp(name, type_names[i]) == 0)return (log_event_type_t)i;
+  }
+  return LOG_EV_NONE;
+}
+
+int log_bin_open(log_bin_writer_t * w, const char * path){
+  char * index_path;
+  struct stat st;
+  log_file_header_t header = {
+    .magic = LOG_FILE_MAGIC,
+    .version = LOG_FILE_VERSION,
+    .record_size = sizeof(log_event_t),
+    .created = (int64_t)time(NULL)
+  };
+
+  w->records = 0;
+  w->data = fopen(path, "a+");
+  if(w->data == NULL)return -1;
+  if(fstat(fileno(w->data), &st) == -1)goto fail_data;
+
+  if(st.st_size == 0){
+    if(fwrite(&header, sizeof(header), 1, w->data) != 1)goto fail_data;
+  }
+  else{
+    /* continue an existing log, dropping a record that was only partly written */
+    log_file_header_t existing;
+    if(fread(&existing, sizeof(existing), 1, w->data) != 1 || existing.magic != LOG_FILE_MAGIC
+       || existing.version != LOG_FILE_VERSION || existing.record_size != sizeof(log_event_t)){
+      errno = EINVAL;
+      goto fail_data;
+    }
+    w->records = (st.st_size - sizeof(header)) / sizeof(log_event_t);
+    if(ftruncate(fileno(w->data), sizeof(header) + (off_t)w->records * sizeof(log_event_t)) == -1)goto fail_data;
+    /* the stream read the header, it has to be positioned before it writes */
+    if(fseek(w->data, 0, SEEK_END) == -1)goto fail_data;
+  }
+
+  ASPRINTF_ERROR(asprintf( &index_path, "%s%s", path, LOG_INDEX_SUFFIX));
+  w->index = fopen(index_path, "a+");
+  free(index_path);
+  if(w->index == NULL)goto fail_data;
+
+  /* keep the index entries of the records that survived, they are written in record order */
+  log_index_entry_t entry;
+  long kept = 0;
+  while(fread(&entry, sizeof(entry), 1, w->index) == 1 && entry.record < w->records)kept++;
+  if(ferror(w->index) || ftruncate(fileno(w->index), kept * (off_t)sizeof(entry)) == -1
+     || fseek(w->index, 0, SEEK_END) == -1)goto fail_index;
+  return 0;
+
+fail_index:
+  fclose(w->index);
+  w->index = NULL;
+fail_data:
+  fclose(w->data);
+  w->data = NULL;
+  return -1;
+}
+
+int log_bin_append(log_bin_writer_t * w, const log_event_t * ev){
+  if(w->records % LOG_INDEX_STRIDE == 0){
+    log_index_entry_t entry = { .ts = ev->ts, .seq = ev->seq, .record = w->records };
+    if(fwrite(&entry, sizeof(entry), 1, w->index) != 1)return -1;
+  }
+  if(fwrite(ev, sizeof(*ev), 1, w->data) != 1)return -1;
+  w->records++;
+  return 0;
+}
+
+int log_bin_flush(log_bin_writer_t * w){
+  if(fflush(w->data) == EOF)return EOF;
+  return fflush(w->index);
+}
+
+int log_bin_close(log_bin_writer_t * w){
+  int result = 0;
+  if(fclose(w->index) == EOF)result = -1;
+  if(fclose(w->data) == EOF)result = -1;
+  w->data = w->index = NULL;
+  return result;
+}
@@ -0,0 +1,157 @@
+#ifndef _LOGEVENT_H_
+#define _LOGEVENT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <semaphore.h>
+#include "config.h"
+
+/*
+ * Layout of the binary event log:
+ *   log_file_header_t, followed by fixed-size log_event_t records
+ * Every LOG_INDEX_STRIDE records the writer appends a log_index_entry_t to '<file>.idx',
+ * which the decoder uses to seek close to a requested start time
+ */
+#define LOG_FILE_MAGIC      0x56455747u    // "GWEV"
+#define LOG_FILE_VERSION    1
+#define LOG_INDEX_STRIDE    256
+#define LOG_INDEX_SUFFIX    ".idx"
+
+#define LOG_MSG_MAX         128            // max length of a rendered event message
+
+typedef enum{
+  LOG_EV_NONE = 0,
+  LOG_EV_CONN_OPEN,            // a sensor node opened a new connection
+  LOG_EV_CONN_CLOSE,           // a sensor node closed (timed out) its connection
+  LOG_EV_SENSOR_INVALID,       // reading from a sensor id that is not in the sensor map
+  LOG_EV_TOO_HOT,              // value = running average
+  LOG_EV_TOO_COLD,             // value = running average
+  LOG_EV_DB_CONNECTED,
+  LOG_EV_DB_LOST,
+  LOG_EV_DB_UNREACHABLE,
+  LOG_EV_DB_TABLE_CREATED,
+  LOG_EV_EVENTS_DROPPED,       // value = number of events lost because the log ring was full
+  LOG_EV_SUPPRESSED,           // value = number of rate limited events, arg = suppressed type | seconds << 16
+  LOG_EV_ROOM_TOO_HOT,         // sensor_id = room id, value = room average
+  LOG_EV_ROOM_TOO_COLD,        // sensor_id = room id, value = room average
+  LOG_EV_TEMP_NORMAL,          // the running average is back in range, value = running average
+  LOG_EV_ROOM_NORMAL,          // sensor_id = room id, value = room average
+  LOG_EV_MAP_RELOADED,         // value = number of sensors in the new map
+  LOG_EV_SENSOR_PROVISIONAL,   // first reading from a sensor id that is not in the sensor map, now tracked provisionally
+  LOG_EV_SENSOR_SILENT,        // no reading for the silence timeout of the sensor's room, value = seconds since the last one
+  LOG_EV_SENSOR_STUCK,         // the same value for the flatline timeout of the sensor's room, value = that value
+  LOG_EV_SENSOR_RESUMED,       // a silent sensor reports again
+  LOG_EV_SENSOR_UNSTUCK,       // a stuck sensor reports a new value, value = the new value
+  LOG_EV_DUPLICATES_DROPPED,   // on closing a connection, value = retransmitted readings of it that were dropped
+  LOG_EV_TYPE_COUNT
+}log_event_type_t;
+
+/*
+ * One event, as it travels from the gateway to the log process and as it is stored in the binary log
+ * 'seq' and 'ts' are stamped by the log process, the gateway only fills in type, sensor_id, value and arg
+ */
+typedef struct{
+  uint32_t          seq;
+  uint16_t          type;
+  sensor_id_t     sensor_id;
+  int64_t            ts;
+  double             value;
+  uint32_t          arg;          // type specific argument, 0 if unused
+  uint32_t          reserved;
+}log_event_t;
+
+typedef struct{
+  uint32_t          magic;
+  uint16_t          version;
+  uint16_t          record_size;
+  int64_t            created;
+}log_file_header_t;
+
+typedef struct{
+  int64_t            ts;           // timestamp of the indexed record
+  uint32_t          seq;          // sequence number of the indexed record
+  uint32_t          record;       // record number within the data file
+}log_index_entry_t;
+
+typedef struct{
+  FILE *             data;
+  FILE *             index;
+  uint32_t          records;
+}log_bin_writer_t;
+
+/*
+ * Routes all subsequent log_event() calls to 'fifo', serialized with 'sema'
+ * Until this is called (e.g. in standalone tools), log_event() silently drops events
+ */
+void log_event_attach_fifo(FILE * fifo, sem_t * sema);
+
+/*
+ * Routes all subsequent log_event() calls to the shared-memory ring 'ring' instead of a FIFO
+ */
+struct logring;
+void log_event_attach_ring(struct logring * ring);
+
+/*
+ * Sends one event to the log process. No formatting is done on the caller's side
+ * Repetitive sensor events are rate limited per (type, sensor id), see lograte.h
+ * With a ring attached this never blocks: if the ring is full the event is dropped and counted
+ */
+void log_event(log_event_type_t type, sensor_id_t sensor_id, double value);
+
+/*
+ * Starts the thread that sends the LOG_EV_SUPPRESSED summaries of lograte.h once their period has ended,
+ * call after attaching the FIFO or the ring
+ */
+void log_event_start_summaries(void);
+
+/*
+ * Stops the summary thread and sends a LOG_EV_SUPPRESSED summary for every (type, sensor) that has rate limited events pending,
+ * call before closing the log transport
+ */
+void log_event_flush_summaries(void);
+
+/*
+ * Reads the next event sent with log_event() from 'fifo'
+ * Returns 1 if an event was read into 'ev', 0 at end of stream
+ */
+int log_event_read(FILE * fifo, log_event_t * ev);
+
+/*
+ * Renders the human readable message of 'ev' (without sequence number, timestamp or newline) in 'buf'
+ * Returns the number of characters written, like snprintf
+ */
+int log_event_format(const log_event_t * ev, char * buf, size_t len);
+
+/*
+ * Short name of an event type as used on the decoder command line ("too_hot", "conn_open", ...)
+ * log_event_type_from_name returns LOG_EV_NONE for unknown names
+ */
+const char * log_event_type_name(uint16_t type);
+log_event_type_t log_event_type_from_name(const char * name);
+
+/*
+ * Opens the binary log 'path' and its index '<path>.idx' for appending, writing the file header if 'path' is new
+ * Returns 0 on success, -1 if an error occurs (errno is EINVAL if 'path' is not a binary log of this version)
+ */
+int log_bin_open(log_bin_writer_t * w, const char * path);
+
+/*
+ * Appends 'ev' to the binary log and, every LOG_INDEX_STRIDE records, an entry to the index
+ * Returns 0 on success, -1 if an error occurs
+ */
+int log_bin_append(log_bin_writer_t * w, const log_event_t * ev);
+
+/*
+ * Flushes both files of the binary log
+ * Returns 0 on success, EOF if an error occurs
+ */
+int log_bin_flush(log_bin_writer_t * w);
+
+/*
+ * Closes both files of the binary log
+ * Returns 0 on success, -1 if an error occurs
+ */
+int log_bin_close(log_bin_writer_t * w);
+
+#endif /* _LOGEVENT_H_ */
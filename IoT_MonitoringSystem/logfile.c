@@ -0,0 +1,448 @@
+#define _GNU_SOURCE
+/*-----------------------------------------------------------------------------
+		include files
+------------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <glob.h>
+#include <pthread.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "logfile.h"
+#include "logevent.h"
+#include "errmacros.h"
+#include "lib/dplist.h"
+
+/*------------------------------------------------------------------------------
+		definitions (defines, typedefs, ...)
+------------------------------------------------------------------------------*/
+#define TMP_SUFFIX        ".tmp"
+#define COPY_CHUNK        (64 * 1024)
+#define ROTATE_RETRY     60              // seconds before a failed rotation is tried again
+#define STAMP_FORMAT     "%Y%m%d-%H%M%S"  // segments are named '<path>.<stamp>', or '<path>.<stamp>-<n>' after a collision
+#define STAMP_LENGTH     15
+
+struct logfile{
+  char *                  path;
+  bool                     binary;
+  long                     max_size;
+  int                       interval;
+  int                       retain;
+
+  FILE *                  text;          // active file in text format
+  log_bin_writer_t   bin;           // active file in binary format
+  long                     size;          // bytes in the active file
+  time_t                  opened;        // when the active file was started
+  time_t                  rotate_after;  // no rotation before this time, after one failed
+
+  pthread_t             compressor;
+  pthread_mutex_t   lock;
+  pthread_cond_t     cond;
+  dplist_t *             pending;       // segments waiting for compression, oldest first
+  bool                     closing;
+};
+
+/*------------------------------------------------------------------------------
+		function declarations
+------------------------------------------------------------------------------*/
+static int       open_active           (logfile_t * lf, const char * path);
+static int       close_active          (logfile_t * lf);
+static int       rotate                   (logfile_t * lf);
+static int       rotate_failed         (logfile_t * lf, char * tmp_path, time_t now);
+static void     queue_segment     (logfile_t * lf, const char * segment);
+static void *   compress_thread   (void * arg);
+static int       compress_segment(const char * segment);
+static void     apply_retention     (logfile_t * lf);
+static void     queue_leftovers    (logfile_t * lf);
+static bool     is_plain_segment (const char * name);
+static void     sort_segments      (logfile_t * lf, glob_t * found);
+static int       segment_compare  (const void * x, const void * y, void * arg);
+
+static void *   path_copy            (void * element);
+static void     path_free             (void ** element);
+static int       path_compare       (void * x, void * y);
+
+/*------------------------------------------------------------------------------
+		implementation code
+------------------------------------------------------------------------------*/
+logfile_t * logfile_open(const char * path, bool binary, long max_size, int interval, int retain){
+  int presult;
+  logfile_t * lf = calloc(1, sizeof(logfile_t));
+  if(lf == NULL)return NULL;
+
+  lf->path = strdup(path);
+  assert(lf->path != NULL);
+  lf->binary = binary;
+  lf->max_size = max_size;
+  lf->interval = interval;
+  lf->retain = retain;
+
+  if(open_active(lf, path) == -1){
+    free(lf->path);
+    free(lf);
+    return NULL;
+  }
+  lf->opened = time(NULL);
+
+  lf->pending = dpl_create(&path_copy, &path_free, &path_compare);
+  assert(lf->pending != NULL);
+  presult = pthread_mutex_init(&lf->lock, NULL);
+  ERROR_HANDLER(presult);
+  presult = pthread_cond_init(&lf->cond, NULL);
+  ERROR_HANDLER(presult);
+
+  /* segments rotated by a previous run that did not get compressed before it stopped */
+  queue_leftovers(lf);
+
+  presult = pthread_create(&lf->compressor, NULL, &compress_thread, lf);
+  ERROR_HANDLER(presult);
+  return lf;
+}
+
+int logfile_write(logfile_t * lf, const log_event_t * ev){
+  if(((lf->max_size > 0 && lf->size >= lf->max_size) ||
+      (lf->interval > 0 && difftime(time(NULL), lf->opened) >= (double)lf->interval)) &&
+     (lf->rotate_after == 0 || time(NULL) >= lf->rotate_after)){
+    if(rotate(lf) == -1)return -1;
+  }
+
+  if(lf->binary){
+    if(log_bin_append(&lf->bin, ev) == -1)return -1;
+    if(log_bin_flush(&lf->bin) == EOF)return -1;
+    lf->size += sizeof(log_event_t);
+  }
+  else{
+    char msg[LOG_MSG_MAX];
+    int bytes;
+    log_event_format(ev, msg, sizeof(msg));
+    bytes = fprintf(lf->text, "%" PRIu32 " %" PRId64 " %s\n", ev->seq, ev->ts, msg);
+    if(bytes < 0)return -1;
+    if(fflush(lf->text) == EOF)return -1;
+    lf->size += bytes;
+  }
+  return 0;
+}
+
+int logfile_close(logfile_t ** lf){
+  int presult, result;
+
+  result = close_active(*lf);
+
+  presult = pthread_mutex_lock(&(*lf)->lock);
+  ERROR_HANDLER(presult);
+  (*lf)->closing = true;
+  presult = pthread_cond_signal(&(*lf)->cond);
+  ERROR_HANDLER(presult);
+  presult = pthread_mutex_unlock(&(*lf)->lock);
+  ERROR_HANDLER(presult);
+
+  presult = pthread_join((*lf)->compressor, NULL);
+  ERROR_HANDLER(presult);
+
+  pthread_mutex_destroy(&(*lf)->lock);
+  pthread_cond_destroy(&(*lf)->cond);
+  dpl_free(&(*lf)->pending);
+  free((*lf)->path);
+  free(*lf);
+  *lf = NULL;
+  return result;
+}
+
+static int open_active(logfile_t * lf, const char * path){
+  struct stat st;
+  if(lf->binary){
+    if(log_bin_open(&lf->bin, path) == -1)return -1;
+    lf->size = sizeof(log_file_header_t) + (long)lf->bin.records * sizeof(log_event_t);
+  }
+  else{
+    lf->text = fopen(path, "a");
+    if(lf->text == NULL)return -1;
+    if(fstat(fileno(lf->text), &st) == -1)return -1;
+    lf->size = st.st_size;
+  }
+  return 0;
+}
+
+static int close_active(logfile_t * lf){
+  if(lf->binary)return log_bin_close(&lf->bin);
+  return fclose(lf->text) == EOF ? -1 : 0;
+}
+
+/*
+ * The new active file is prepared under a temporary name and then renamed over 'path', so 'path' always
+ * names a complete log file. The old file first gets a second name (the segment), so a reader that still
+ * has it open (e.g. tail -F) keeps reading the same inode to its end before it reopens 'path'
+ */
+static int rotate(logfile_t * lf){
+  char stamp[32], *tmp_path, *segment = NULL;
+  time_t now = time(NULL);
+  int attempt, result = 0;
+
+  /* the compressor syncs the closed segment, the reader never waits for the disk here */
+  if(close_active(lf) == -1)return -1;
+
+  ASPRINTF_ERROR(asprintf(&tmp_path, "%s%s", lf->path, TMP_SUFFIX));
+  unlink(tmp_path);
+  if(lf->binary){
+    char * tmp_index;
+    ASPRINTF_ERROR(asprintf(&tmp_index, "%s%s", tmp_path, LOG_INDEX_SUFFIX));
+    unlink(tmp_index);
+    free(tmp_index);
+  }
+  if(open_active(lf, tmp_path) == -1){
+    free(tmp_path);
+    return open_active(lf, lf->path) == -1 ? -1 : 0;   // keep appending to the old file
+  }
+
+  strftime(stamp, sizeof(stamp), STAMP_FORMAT, gmtime(&now));
+  for(attempt = 0; ; attempt++){
+    if(attempt == 0)ASPRINTF_ERROR(asprintf(&segment, "%s.%s", lf->path, stamp));
+    else ASPRINTF_ERROR(asprintf(&segment, "%s.%s-%d", lf->path, stamp, attempt));
+    if(link(lf->path, segment) == 0)break;
+    free(segment);
+    segment = NULL;
+    if(errno != EEXIST){
+      perror("Naming the log segment failed");
+      result = -1;
+      break;
+    }
+  }
+  if(result == 0 && rename(tmp_path, lf->path) == -1){
+    perror("Renaming the new log file failed");
+    unlink(segment);    // the old file is still 'path', a second name would be compressed as a segment
+    free(segment);
+    segment = NULL;
+    result = -1;
+  }
+  if(result == -1)return rotate_failed(lf, tmp_path, now);
+
+  if(lf->binary){
+    char *index_path, *tmp_index, *segment_index;
+    ASPRINTF_ERROR(asprintf(&index_path, "%s%s", lf->path, LOG_INDEX_SUFFIX));
+    ASPRINTF_ERROR(asprintf(&tmp_index, "%s%s", tmp_path, LOG_INDEX_SUFFIX));
+    ASPRINTF_ERROR(asprintf(&segment_index, "%s%s", segment, LOG_INDEX_SUFFIX));
+    if(link(index_path, segment_index) == -1 || rename(tmp_index, index_path) == -1){
+      perror("Rotating the log index failed");
+    }
+    free(index_path);
+    free(tmp_index);
+    free(segment_index);
+  }
+  free(tmp_path);
+  lf->opened = now;
+  lf->rotate_after = 0;
+
+  DEBUG_PRINT("rotated %s to %s\n", lf->path, segment);
+  queue_segment(lf, segment);
+  free(segment);
+  return 0;
+}
+
+/*
+ * Gives up on a rotation that could not rename the files (e.g. EPERM, EXDEV, ENOSPC): the prepared file is
+ * dropped and logging goes on appending to 'path', the next attempt waits ROTATE_RETRY seconds
+ */
+static int rotate_failed(logfile_t * lf, char * tmp_path, time_t now){
+  close_active(lf);
+  unlink(tmp_path);
+  if(lf->binary){
+    char * tmp_index;
+    ASPRINTF_ERROR(asprintf(&tmp_index, "%s%s", tmp_path, LOG_INDEX_SUFFIX));
+    unlink(tmp_index);
+    free(tmp_index);
+  }
+  free(tmp_path);
+  lf->rotate_after = now + ROTATE_RETRY;
+  return open_active(lf, lf->path) == -1 ? -1 : 0;
+}
+
+static void queue_segment(logfile_t * lf, const char * segment){
+  int presult;
+  presult = pthread_mutex_lock(&lf->lock);
+  ERROR_HANDLER(presult);
+  lf->pending = dpl_insert_at_index(lf->pending, (void *)segment, dpl_size(lf->pending), true);
+  assert(lf->pending != NULL);
+  presult = pthread_cond_signal(&lf->cond);
+  ERROR_HANDLER(presult);
+  presult = pthread_mutex_unlock(&lf->lock);
+  ERROR_HANDLER(presult);
+}
+
+/* compresses queued segments one by one; on close it finishes the queue before it exits */
+static void * compress_thread(void * arg){
+  logfile_t * lf = arg;
+  int presult;
+
+  presult = pthread_mutex_lock(&lf->lock);
+  ERROR_HANDLER(presult);
+  while(1){
+    while(dpl_size(lf->pending) == 0 && !lf->closing){
+      presult = pthread_cond_wait(&lf->cond, &lf->lock);
+      ERROR_HANDLER(presult);
+    }
+    if(dpl_size(lf->pending) == 0)break;
+
+    char * segment = strdup(dpl_get_element_at_index(lf->pending, 0));
+    assert(segment != NULL);
+    lf->pending = dpl_remove_at_index(lf->pending, 0, true);
+    presult = pthread_mutex_unlock(&lf->lock);
+    ERROR_HANDLER(presult);
+
+    if(compress_segment(segment) == -1){
+      fprintf(stderr, "Compressing log segment %s failed\n", segment);
+    }
+    apply_retention(lf);
+    free(segment);
+
+    presult = pthread_mutex_lock(&lf->lock);
+    ERROR_HANDLER(presult);
+  }
+  presult = pthread_mutex_unlock(&lf->lock);
+  ERROR_HANDLER(presult);
+  return NULL;
+}
+
+/*
+ * Syncs 'segment', writes '<segment>.gz' under a temporary name, renames it into place and only then removes 'segment'
+ * The sync makes the segment durable on its own, even if compressing it fails
+ */
+static int compress_segment(const char * segment){
+  char *gz_path, *tmp_path, *chunk;
+  FILE * in;
+  gzFile out;
+  size_t bytes;
+  int result = 0;
+
+  in = fopen(segment, "r");
+  if(in == NULL)return -1;
+  if(fsync(fileno(in)) == -1)perror("Syncing the log segment failed");
+  ASPRINTF_ERROR(asprintf(&gz_path, "%s%s", segment, LOG_SEGMENT_SUFFIX));
+  ASPRINTF_ERROR(asprintf(&tmp_path, "%s%s", gz_path, TMP_SUFFIX));
+  chunk = malloc(COPY_CHUNK);
+  assert(chunk != NULL);
+
+  out = gzopen(tmp_path, "wb6");
+  if(out == NULL){
+    result = -1;
+  }
+  else{
+    while((bytes = fread(chunk, 1, COPY_CHUNK, in)) > 0){
+      if(gzwrite(out, chunk, bytes) != (int)bytes){
+        result = -1;
+        break;
+      }
+    }
+    if(ferror(in))result = -1;
+    if(gzclose(out) != Z_OK)result = -1;
+  }
+  fclose(in);
+
+  if(result == 0 && rename(tmp_path, gz_path) == 0){
+    unlink(segment);
+  }
+  else{
+    unlink(tmp_path);
+    result = -1;
+  }
+  free(chunk);
+  free(tmp_path);
+  free(gz_path);
+  return result;
+}
+
+/* everything before the last 'retain' compressed segments, in rotation order, goes */
+static void apply_retention(logfile_t * lf){
+  char * pattern;
+  glob_t found;
+  size_t i;
+
+  ASPRINTF_ERROR(asprintf(&pattern, "%s.[0-9]*%s", lf->path, LOG_SEGMENT_SUFFIX));
+  if(glob(pattern, GLOB_NOSORT, NULL, &found) == 0){
+    sort_segments(lf, &found);
+    for(i = 0; i + lf->retain < found.gl_pathc; i++){
+      char * index_path;
+      size_t len = strlen(found.gl_pathv[i]) - strlen(LOG_SEGMENT_SUFFIX);
+      ASPRINTF_ERROR(asprintf(&index_path, "%.*s%s", (int)len, found.gl_pathv[i], LOG_INDEX_SUFFIX));
+      DEBUG_PRINT("removing old log segment %s\n", found.gl_pathv[i]);
+      unlink(found.gl_pathv[i]);
+      unlink(index_path);
+      free(index_path);
+    }
+    globfree(&found);
+  }
+  free(pattern);
+}
+
+static void queue_leftovers(logfile_t * lf){
+  char * pattern;
+  glob_t found;
+  size_t i;
+
+  ASPRINTF_ERROR(asprintf(&pattern, "%s.[0-9]*", lf->path));
+  if(glob(pattern, GLOB_NOSORT, NULL, &found) == 0){
+    sort_segments(lf, &found);
+    for(i = 0; i != found.gl_pathc; i++){
+      if(is_plain_segment(found.gl_pathv[i])){
+        lf->pending = dpl_insert_at_index(lf->pending, found.gl_pathv[i], dpl_size(lf->pending), true);
+      }
+    }
+    globfree(&found);
+  }
+  free(pattern);
+}
+
+/* puts segment names in rotation order: by stamp, and then by collision number (none before -1 before -2 ...) */
+static void sort_segments(logfile_t * lf, glob_t * found){
+  size_t stamp_at = strlen(lf->path) + 1;
+  qsort_r(found->gl_pathv, found->gl_pathc, sizeof(char *), &segment_compare, &stamp_at);
+}
+
+static int segment_compare(const void * x, const void * y, void * arg){
+  const size_t stamp_at = *(const size_t *)arg;
+  const char * a = *(char * const *)x + stamp_at;
+  const char * b = *(char * const *)y + stamp_at;
+  long attempt_a = 0, attempt_b = 0;
+  int result = strncmp(a, b, STAMP_LENGTH);
+
+  if(result != 0)return (result > 0) - (result < 0);
+  if(strlen(a) > STAMP_LENGTH && a[STAMP_LENGTH] == '-')attempt_a = strtol(a + STAMP_LENGTH + 1, NULL, 10);
+  if(strlen(b) > STAMP_LENGTH && b[STAMP_LENGTH] == '-')attempt_b = strtol(b + STAMP_LENGTH + 1, NULL, 10);
+  if(attempt_a != attempt_b)return (attempt_a > attempt_b) - (attempt_a < attempt_b);
+  result = strcmp(a, b);
+  return (result > 0) - (result < 0);
+}
+
+static bool is_plain_segment(const char * name){
+  const char * suffixes[] = { LOG_SEGMENT_SUFFIX, LOG_INDEX_SUFFIX, TMP_SUFFIX };
+  size_t i, len = strlen(name);
+  for(i = 0; i != sizeof(suffixes) / sizeof(suffixes[0]); i++){
+    size_t slen = strlen(suffixes[i]);
+    if(len >= slen && strcmp(name + len - slen, suffixes[i]) == 0)return false;
+  }
+  return true;
+}
+
+static void * path_copy(void * element){
+  char * p = strdup((char *)element);
+  assert(p != NULL);
+  return p;
+}
+
+static void path_free(void ** element){
+  free(*element);
+  *element = NULL;
+}
+
+static int path_compare(void * x, void * y){
+  int result = strcmp((char *)x, (char *)y);
+  return (result > 0) - (result < 0);
+}
@@ -0,0 +1,45 @@
+#ifndef _LOGFILE_H_
+#define _LOGFILE_H_
+
+#include <stdbool.h>
+#include "logevent.h"
+
+#ifndef LOG_ROTATE_SIZE
+  #define LOG_ROTATE_SIZE (16L * 1024 * 1024)    // rotate when the active file reaches this many bytes, 0 = never
+#endif
+
+#ifndef LOG_ROTATE_INTERVAL
+  #define LOG_ROTATE_INTERVAL 0                  // rotate when the active file is this many seconds old, 0 = never
+#endif
+
+#ifndef LOG_RETAIN
+  #define LOG_RETAIN 8                           // number of rotated (compressed) segments to keep
+#endif
+
+/* the defaults above are overridden by gw_config.log_rotate_size, .log_rotate_interval and .log_retain */
+
+#define LOG_SEGMENT_SUFFIX ".gz"
+
+typedef struct logfile logfile_t;
+
+/*
+ * Opens the gateway log 'path' for appending, in text or binary ('binary' is true) format
+ * Rotated segments are named '<path>.<yyyymmdd-hhmmss>' and compressed to '<segment>.gz' by a background thread,
+ * only the newest 'retain' segments are kept
+ * Returns NULL if an error occurs
+ */
+logfile_t * logfile_open(const char * path, bool binary, long max_size, int interval, int retain);
+
+/*
+ * Writes the (already stamped) event 'ev' to the active file, rotating first if the size or age limit is reached
+ * Returns 0 on success, -1 if an error occurs
+ */
+int logfile_write(logfile_t * lf, const log_event_t * ev);
+
+/*
+ * Closes the active file and waits until all pending segments are compressed
+ * Returns 0 on success, -1 if an error occurs
+ */
+int logfile_close(logfile_t ** lf);
+
+#endif /* _LOGFILE_H_ */
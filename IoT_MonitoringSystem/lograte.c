@@ -0,0 +1,177 @@
+#define _GNU_SOURCE
+/*-----------------------------------------------------------------------------
+		include files
+------------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <assert.h>
+
+#include "lograte.h"
+#include "logevent.h"
+#include "errmacros.h"
+#include "gwconfig.h"
+
+/*------------------------------------------------------------------------------
+		definitions (defines, typedefs, ...)
+------------------------------------------------------------------------------*/
+#define INITIAL_BUCKETS   1024           // power of 2, the table doubles at 50% load
+
+typedef struct{
+  uint32_t          key;                // (type << 16 | sensor id), 0 = unused bucket
+  uint32_t          suppressed;         // events dropped since the last summary
+  double             tokens;
+  double             last;               // monotonic time of the last refill
+  double             window_start;       // monotonic time of the first suppressed event since the last summary
+}rate_bucket_t;
+
+/*------------------------------------------------------------------------------
+		global variable declarations
+------------------------------------------------------------------------------*/
+static pthread_mutex_t   rate_lock = PTHREAD_MUTEX_INITIALIZER;
+static rate_bucket_t *   buckets = NULL;
+static uint32_t             capacity = 0;
+static uint32_t             used = 0;
+/* read by every log_event caller without the lock */
+static atomic_bool          tracking = false;        // set once the first limited event created the table
+static _Atomic double     next_sweep = 0;           // monotonic time of the next summary sweep
+
+/*------------------------------------------------------------------------------
+		implementation code
+------------------------------------------------------------------------------*/
+static double now_monotonic(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool is_limited(log_event_type_t type){
+  switch(type){
+    case LOG_EV_CONN_OPEN:
+    case LOG_EV_CONN_CLOSE:
+    case LOG_EV_SENSOR_INVALID:
+    case LOG_EV_TOO_HOT:
+    case LOG_EV_TOO_COLD:
+    case LOG_EV_ROOM_TOO_HOT:
+    case LOG_EV_ROOM_TOO_COLD:
+      return gw_config.log_rate_burst > 0;
+    default:
+      return false;
+  }
+}
+
+static uint32_t hash_key(uint32_t key){
+  key ^= key >> 16;
+  key *= 0x7feb352dU;
+  key ^= key >> 15;
+  key *= 0x846ca68bU;
+  key ^= key >> 16;
+  return key;
+}
+
+static rate_bucket_t * find_bucket(rate_bucket_t * table, uint32_t size, uint32_t key){
+  uint32_t i = hash_key(key) & (size - 1);
+  while(table[i].key != 0 && table[i].key != key){
+    i = (i + 1) & (size - 1);
+  }
+  return &table[i];
+}
+
+static void grow_table(void){
+  uint32_t i, new_capacity = capacity ? capacity * 2 : INITIAL_BUCKETS;
+  rate_bucket_t * table = calloc(new_capacity, sizeof(rate_bucket_t));
+  assert(table != NULL);
+  for(i = 0; i != capacity; i++){
+    if(buckets[i].key != 0)*find_bucket(table, new_capacity, buckets[i].key) = buckets[i];
+  }
+  free(buckets);
+  buckets = table;
+  capacity = new_capacity;
+  atomic_store_explicit(&tracking, true, memory_order_relaxed);
+}
+
+bool lograte_admit(log_event_type_t type, sensor_id_t sensor_id){
+  uint32_t key = ((uint32_t)type << 16) | sensor_id;
+  const double rate = gw_config.log_rate_per_minute / 60.0;
+  rate_bucket_t * b;
+  double now;
+  bool admit;
+  int presult;
+
+  if(!is_limited(type))return true;
+  now = now_monotonic();
+
+  presult = pthread_mutex_lock(&rate_lock);
+  ERROR_HANDLER(presult);
+
+  if(2 * (used + 1) > capacity)grow_table();
+  b = find_bucket(buckets, capacity, key);
+  if(b->key == 0){
+    b->key = key;
+    b->tokens = gw_config.log_rate_burst;
+    b->last = now;
+    used++;
+  }
+
+  b->tokens += (now - b->last) * rate;
+  if(b->tokens > gw_config.log_rate_burst)b->tokens = gw_config.log_rate_burst;
+  b->last = now;
+
+  admit = b->tokens >= 1.0;
+  if(admit){
+    b->tokens -= 1.0;
+  }
+  else{
+    if(b->suppressed == 0)b->window_start = now;
+    b->suppressed++;
+  }
+
+  presult = pthread_mutex_unlock(&rate_lock);
+  ERROR_HANDLER(presult);
+  return admit;
+}
+
+/* the summary thread of logevent.c sweeps a few times per period, so a summary is at most a quarter period late */
+double lograte_sweep_interval(void){
+  return gw_config.log_summary_period >= 4 ? gw_config.log_summary_period / 4.0 : 1.0;
+}
+
+bool lograte_summary_due(void){
+  return atomic_load_explicit(&tracking, memory_order_relaxed) &&
+         now_monotonic() >= atomic_load_explicit(&next_sweep, memory_order_relaxed);
+}
+
+int lograte_collect(log_event_t * out, int max, bool all){
+  double now = now_monotonic();
+  uint32_t i;
+  int count = 0, presult;
+
+  presult = pthread_mutex_lock(&rate_lock);
+  ERROR_HANDLER(presult);
+
+  atomic_store_explicit(&next_sweep, now + lograte_sweep_interval(), memory_order_relaxed);
+  for(i = 0; i != capacity && count != max; i++){
+    rate_bucket_t * b = &buckets[i];
+    if(b->key == 0 || b->suppressed == 0)continue;
+    if(!all && now - b->window_start < gw_config.log_summary_period)continue;
+
+    double window = now - b->window_start + 0.5;
+    if(window > UINT16_MAX)window = UINT16_MAX;
+    out[count++] = (log_event_t){
+      .type = LOG_EV_SUPPRESSED,
+      .sensor_id = (sensor_id_t)(b->key & 0xffff),
+      .value = b->suppressed,
+      .arg = (b->key >> 16) | ((uint32_t)window << 16)
+    };
+    b->suppressed = 0;
+  }
+
+  presult = pthread_mutex_unlock(&rate_lock);
+  ERROR_HANDLER(presult);
+  return count;
+}
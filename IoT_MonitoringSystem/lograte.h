@@ -0,0 +1,45 @@
+#ifndef _LOGRATE_H_
+#define _LOGRATE_H_
+
+#include <stdbool.h>
+#include "config.h"
+#include "logevent.h"
+
+#ifndef LOG_RATE_BURST
+  #define LOG_RATE_BURST 5             // events of one type for one sensor that always pass, 0 = no rate limiting
+#endif
+
+#ifndef LOG_RATE_PER_MINUTE
+  #define LOG_RATE_PER_MINUTE 6        // sustained events per minute of one type for one sensor
+#endif
+
+#ifndef LOG_SUMMARY_PERIOD
+  #define LOG_SUMMARY_PERIOD 60        // seconds between summaries of suppressed events
+#endif
+
+/*
+ * The defaults above are overridden by gw_config.log_rate_burst, .log_rate_per_minute and .log_summary_period
+ *
+ * Token bucket per (event type, sensor id) for the sensor related event types
+ * Returns true if the event may be logged, false if it is suppressed (and counted)
+ */
+bool lograte_admit(log_event_type_t type, sensor_id_t sensor_id);
+
+/*
+ * Fills 'out' with at most 'max' LOG_EV_SUPPRESSED summaries for buckets whose summary period has ended,
+ * or for all buckets with suppressed events if 'all' is true, and resets their counts
+ * Returns the number of summaries written, call again while it returns 'max'
+ */
+int lograte_collect(log_event_t * out, int max, bool all);
+
+/*
+ * Seconds between two sweeps of lograte_collect() for ended summary periods
+ */
+double lograte_sweep_interval(void);
+
+/*
+ * True if a sweep interval has passed since the last lograte_collect() call
+ */
+bool lograte_summary_due(void);
+
+#endif /* _LOGRATE_H_ */
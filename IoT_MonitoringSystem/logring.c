@@ -0,0 +1,161 @@
+#define _GNU_SOURCE
+/*-----------------------------------------------------------------------------
+		include files
+------------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "logring.h"
+#include "logevent.h"
+
+/*------------------------------------------------------------------------------
+		definitions (defines, typedefs, ...)
+------------------------------------------------------------------------------*/
+#define CACHE_LINE 64
+
+/*
+ * A slot is free for the producer that claims position p when seq == p,
+ * and holds an event for the consumer when seq == p + 1 (Vyukov's bounded queue)
+ */
+typedef struct{
+  _Atomic uint64_t   seq;
+  log_event_t          ev;
+}logring_slot_t;
+
+struct logring{
+  _Alignas(CACHE_LINE) _Atomic uint64_t head;      // next position claimed by a producer
+  _Alignas(CACHE_LINE) uint64_t tail;              // next position read by the consumer (consumer only)
+  _Alignas(CACHE_LINE) _Atomic uint32_t wake;      // futex word, bumped when a sleeping consumer must wake
+  _Atomic uint32_t   sleeping;
+  _Atomic uint32_t   closed;
+  _Atomic uint64_t   dropped;
+  uint32_t              mask;
+  size_t                 map_size;
+  _Alignas(CACHE_LINE) logring_slot_t slots[];
+};
+
+/*------------------------------------------------------------------------------
+		implementation code
+------------------------------------------------------------------------------*/
+/* the ring lives in memory shared by two processes, so this is a non-private futex */
+static long futex(_Atomic uint32_t * addr, int op, uint32_t val, const struct timespec * timeout){
+  return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+logring_t * logring_create(uint32_t slots){
+  logring_t * ring;
+  uint32_t capacity = 1, i;
+  size_t size;
+
+  while(capacity < slots)capacity <<= 1;
+  size = sizeof(logring_t) + (size_t)capacity * sizeof(logring_slot_t);
+
+  ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(ring == MAP_FAILED)return NULL;
+
+  atomic_init(&ring->head, 0);
+  ring->tail = 0;
+  atomic_init(&ring->wake, 0);
+  atomic_init(&ring->sleeping, 0);
+  atomic_init(&ring->closed, 0);
+  atomic_init(&ring->dropped, 0);
+  ring->mask = capacity - 1;
+  ring->map_size = size;
+  for(i = 0; i != capacity; i++){
+    atomic_init(&ring->slots[i].seq, i);
+  }
+  return ring;
+}
+
+void logring_destroy(logring_t ** ring){
+  munmap(*ring, (*ring)->map_size);
+  *ring = NULL;
+}
+
+int logring_push(logring_t * ring, const log_event_t * ev){
+  logring_slot_t * slot;
+  uint64_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+  while(1){
+    slot = &ring->slots[pos & ring->mask];
+    uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    int64_t dif = (int64_t)(seq - pos);
+    if(dif == 0){
+      if(atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))break;
+    }
+    else if(dif < 0){
+      /* the consumer has not freed this slot yet: the ring is full */
+      atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+      return -1;
+    }
+    else{
+      pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    }
+  }
+
+  slot->ev = *ev;
+  atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+  /* pairs with the fence in logring_pop: either the consumer sees the event or we see it sleeping */
+  atomic_thread_fence(memory_order_seq_cst);
+  if(atomic_load_explicit(&ring->sleeping, memory_order_relaxed)){
+    atomic_fetch_add_explicit(&ring->wake, 1, memory_order_relaxed);
+    futex(&ring->wake, FUTEX_WAKE, 1, NULL);
+  }
+  return 0;
+}
+
+static int try_pop(logring_t * ring, log_event_t * ev){
+  logring_slot_t * slot = &ring->slots[ring->tail & ring->mask];
+  uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+  if(seq != ring->tail + 1)return 0;
+
+  *ev = slot->ev;
+  atomic_store_explicit(&slot->seq, ring->tail + ring->mask + 1, memory_order_release);
+  ring->tail++;
+  return 1;
+}
+
+int logring_pop(logring_t * ring, log_event_t * ev, int timeout_ms){
+  struct timespec timeout = { .tv_sec = timeout_ms / 1000, .tv_nsec = (long)(timeout_ms % 1000) * 1000000 };
+  uint32_t wake;
+
+  if(try_pop(ring, ev))return LOGRING_EVENT;
+
+  wake = atomic_load_explicit(&ring->wake, memory_order_relaxed);
+  atomic_store_explicit(&ring->sleeping, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  if(try_pop(ring, ev)){
+    atomic_store_explicit(&ring->sleeping, 0, memory_order_relaxed);
+    return LOGRING_EVENT;
+  }
+  if(atomic_load_explicit(&ring->closed, memory_order_acquire)){
+    atomic_store_explicit(&ring->sleeping, 0, memory_order_relaxed);
+    /* a producer may still have been finishing its push when close was called */
+    return try_pop(ring, ev) ? LOGRING_EVENT : LOGRING_CLOSED;
+  }
+
+  /* returns at once with EAGAIN if a producer bumped 'wake' after we read it */
+  futex(&ring->wake, FUTEX_WAIT, wake, &timeout);
+  atomic_store_explicit(&ring->sleeping, 0, memory_order_relaxed);
+
+  return try_pop(ring, ev) ? LOGRING_EVENT : LOGRING_EMPTY;
+}
+
+void logring_close(logring_t * ring){
+  atomic_store_explicit(&ring->closed, 1, memory_order_release);
+  atomic_fetch_add_explicit(&ring->wake, 1, memory_order_seq_cst);
+  futex(&ring->wake, FUTEX_WAKE, 1, NULL);
+}
+
+uint64_t logring_dropped(logring_t * ring){
+  return atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+}
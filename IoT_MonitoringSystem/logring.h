@@ -0,0 +1,55 @@
+#ifndef _LOGRING_H_
+#define _LOGRING_H_
+
+#include <stdint.h>
+#include "logevent.h"
+
+#ifndef LOG_RING_SLOTS
+  #define LOG_RING_SLOTS 4096      // default of gw_config.log_ring_slots, rounded up to a power of 2
+#endif
+
+#define LOGRING_EMPTY    -1
+#define LOGRING_CLOSED    0
+#define LOGRING_EVENT     1
+
+/*
+ * Bounded multi-producer / single-consumer ring of log events in anonymous shared memory
+ * Create it before fork(): the gateway threads push, the log process pops
+ */
+typedef struct logring logring_t;
+
+/*
+ * Maps a new ring with room for at least 'slots' events (MAP_SHARED | MAP_ANONYMOUS)
+ * Returns NULL if an error occurs
+ */
+logring_t * logring_create(uint32_t slots);
+
+/*
+ * Unmaps the ring in the calling process
+ */
+void logring_destroy(logring_t ** ring);
+
+/*
+ * Copies 'ev' into the ring without blocking and without a syscall, unless the consumer is asleep
+ * Returns 0 on success, -1 if the ring is full (the event is counted as dropped)
+ */
+int logring_push(logring_t * ring, const log_event_t * ev);
+
+/*
+ * Takes the oldest event from the ring, sleeping on a futex for at most 'timeout_ms' while it is empty
+ * Returns LOGRING_EVENT if 'ev' was filled in, LOGRING_EMPTY on timeout,
+ * LOGRING_CLOSED once the ring is closed and drained
+ */
+int logring_pop(logring_t * ring, log_event_t * ev, int timeout_ms);
+
+/*
+ * Marks the end of the stream and wakes up the consumer
+ */
+void logring_close(logring_t * ring);
+
+/*
+ * Number of events dropped so far because the ring was full
+ */
+uint64_t logring_dropped(logring_t * ring);
+
+#endif /* _LOGRING_H_ */
@@ -11,6 +11,7 @@
 #include <time.h>
 #include <semaphore.h>
 #include <assert.h>
+#include <inttypes.h>
 
 #include "errmacros.h"
 #include "config.h"
@@ -18,13 +19,15 @@
 #include "datamgr.h"
 #include "connmgr.h"
 #include "sensor_db.h"
+#include "logevent.h"
+#include "logfile.h"
+#include "logring.h"
+#include "gwconfig.h"
 
 /*------------------------------------------------------------------------------
 		definitions (defines, typedefs, ...)
 ------------------------------------------------------------------------------*/
-#define FIFO_NAME  "logFifo" 
-#define FILE_NAME  "gateway.log"     
-#define MAX  100
+#define RING_POLL_MS  1000              /* how often the log process checks on the gateway while the ring is idle */
 
 /*------------------------------------------------------------------------------
 		global variable declarations
@@ -33,16 +36,20 @@ sbuffer_t * fir_buffer;
 sbuffer_t * sec_buffer;
 FILE        *fp;
 sem_t        fifo_sem;
+logring_t * log_ring = NULL;           /* replaces the FIFO when log_transport = ring */
 pthread_mutex_t mutexsum;
 
 /*------------------------------------------------------------------------------
 		function declarations
 ------------------------------------------------------------------------------*/
 void print_help                     (void);
+int   parse_arguments          (int argc, char *argv[]);
 void final_message               (void) ;
 void run_log_process            (int exit_code);
 void manage_threads           (int port);
-void get_info_from_fifo         (char buf[MAX], FILE * fp_fifo, FILE * fp_log);
+void get_info_from_fifo         (FILE * fp_fifo, logfile_t * log);
+void get_info_from_ring        (logring_t * ring, pid_t gateway_pid, logfile_t * log);
+void write_event                  (logfile_t * log, log_event_t * ev, uint32_t * sequence_num);
 int   callback_func		      (void *data, int argc, char **argv, char **azColName); 
 
 /*------------------------------------------------------------------------------
@@ -57,7 +64,7 @@ void *conn_mgr( void *port){
 }
 
 void *data_mgr( void *id){
-  FILE * fp_sensor_map = fopen("room_sensor.map", "r");
+  FILE * fp_sensor_map = fopen(gw_config.sensor_map, "r");
   FILE_OPEN_ERROR(fp_sensor_map);
   datamgr_parse_sensor_data(fp_sensor_map, &fir_buffer); 
   datamgr_free();
@@ -81,7 +88,14 @@ int main( int argc, char *argv[] ){
   my_pid = getpid();
   printf("Parent process (pid = %d) is started ...\n", my_pid);
   
-  int server_port;
+  /* the configuration is loaded before fork() so the log process shares it */
+  int server_port = parse_arguments(argc, argv);
+  
+  if(gw_config.log_transport == LOG_TRANSPORT_RING){
+    /* the ring must exist before fork() so both processes map the same pages */
+    log_ring = logring_create(gw_config.log_ring_slots);
+    FILE_OPEN_ERROR(log_ring);
+  }
   
   child_pid = fork();
   SYSCALL_ERROR(child_pid);
@@ -94,15 +108,6 @@ int main( int argc, char *argv[] ){
   else{
     /* parent’s code */
     DEBUG_PRINT("Parent process (pid = %d) has created child process (pid = %d)...\n", my_pid, child_pid);
-    if (argc != 2)
-    {
-      print_help();
-      exit(EXIT_SUCCESS);
-    }
-    else{
-      server_port = atoi(argv[1]);
-    }
-    
     manage_threads(server_port);
   }
   
@@ -119,6 +124,45 @@ int main( int argc, char *argv[] ){
   exit(EXIT_SUCCESS);
 }
 
+/* applies -c and -o to gw_config and returns the server port */
+int parse_arguments(int argc, char *argv[]){
+  const char * config_file = NULL;
+  char ** overrides = calloc(argc, sizeof(char *));
+  int opt, i, count = 0, result = 0;
+  assert(overrides != NULL);
+  
+  while((opt = getopt(argc, argv, "c:o:h")) != -1){
+    switch(opt){
+      case 'c':
+        config_file = optarg;
+        break;
+      case 'o':
+        overrides[count++] = optarg;
+        break;
+      default:
+        print_help();
+        exit(EXIT_SUCCESS);
+    }
+  }
+  if(optind != argc - 1){
+    print_help();
+    exit(EXIT_SUCCESS);
+  }
+  
+  /* command line overrides win over the file, whatever their order */
+  if(config_file != NULL && gwconfig_load(config_file) == -1)result = -1;
+  for(i = 0; i != count; i++){
+    if(gwconfig_override(overrides[i]) == -1)result = -1;
+  }
+  free(overrides);
+  if(result == -1 || gwconfig_validate() == -1)exit(EXIT_FAILURE);
+#ifdef DEBUG
+  gwconfig_print(stdout);
+#endif
+  
+  return atoi(argv[optind]);
+}
+
 void manage_threads(int port){
     int               presult;
     pthread_t     thread_connmgr     ;
@@ -128,13 +172,20 @@ void manage_threads(int port){
     presult= sem_init(&fifo_sem, 0, 1);
     ERROR_HANDLER(presult);
     
-    /* Create the FIFO if it does not exist */ 
-    presult = mkfifo(FIFO_NAME, 0666);
-    CHECK_MKFIFO(presult); 
-    
-    fp = fopen(FIFO_NAME, "w"); 
-    DEBUG_PRINT("syncing with reader ok\n");
-    FILE_OPEN_ERROR(fp);
+    if(log_ring != NULL){
+      log_event_attach_ring(log_ring);
+    }
+    else{
+      /* Create the FIFO if it does not exist */ 
+      presult = mkfifo(gw_config.fifo_name, 0666);
+      CHECK_MKFIFO(presult); 
+      
+      fp = fopen(gw_config.fifo_name, "w"); 
+      DEBUG_PRINT("syncing with reader ok\n");
+      FILE_OPEN_ERROR(fp);
+      log_event_attach_fifo(fp, &fifo_sem);
+    }
+    log_event_start_summaries();
     
     presult = sbuffer_init(&fir_buffer);
     SBUFFER_ERROR(presult);
@@ -158,8 +209,14 @@ void manage_threads(int port){
     presult= pthread_join(thread_storagemgr, NULL);
     ERROR_HANDLER(presult);
     
-    presult = fclose( fp );
-    FILE_CLOSE_ERROR(presult);
+    log_event_flush_summaries();
+    if(log_ring != NULL){
+      logring_close(log_ring);
+    }
+    else{
+      presult = fclose( fp );
+      FILE_CLOSE_ERROR(presult);
+    }
     
     presult = sem_destroy(&fifo_sem);
     ERROR_HANDLER(presult);
@@ -169,57 +226,94 @@ void manage_threads(int port){
 }
 
 void run_log_process(int exit_code){
-  FILE *fp_logfile, *fp_gateway; 
+  logfile_t * log;
   int result;
-  char recv_buf[MAX]; 
-  
-  /* Create the FIFO if it does not exist */ 
-  result = mkfifo(FIFO_NAME, 0666);
-  CHECK_MKFIFO(result); 
-  
-  fp_logfile = fopen(FIFO_NAME, "r"); 
-  DEBUG_PRINT("syncing with writer ok\n");
-  FILE_OPEN_ERROR(fp_logfile);
-  
-  fp_gateway = fopen(FILE_NAME, "w"); 
-  DEBUG_PRINT("open the file gateway.log\n");
-  FILE_OPEN_ERROR(fp_gateway);
   
-  /* Enter while loop to read fifo */
-  get_info_from_fifo(recv_buf, fp_logfile, fp_gateway);
+  if(gw_config.log_format == LOG_FORMAT_BINARY){
+    log = logfile_open(gw_config.log_bin_file, true, gw_config.log_rotate_size, gw_config.log_rotate_interval, gw_config.log_retain);
+  }
+  else{
+    log = logfile_open(gw_config.log_file, false, gw_config.log_rotate_size, gw_config.log_rotate_interval, gw_config.log_retain);
+  }
+  DEBUG_PRINT("open the gateway log\n");
+  FILE_OPEN_ERROR(log);
   
-  result = fclose( fp_gateway);
-  FILE_CLOSE_ERROR(result);
+  if(log_ring != NULL){
+    /* Enter while loop to read the ring */
+    get_info_from_ring(log_ring, getppid(), log);
+    logring_destroy(&log_ring);
+  }
+  else{
+    FILE *fp_logfile;
+    
+    /* Create the FIFO if it does not exist */ 
+    result = mkfifo(gw_config.fifo_name, 0666);
+    CHECK_MKFIFO(result); 
+    
+    fp_logfile = fopen(gw_config.fifo_name, "r"); 
+    DEBUG_PRINT("syncing with writer ok\n");
+    FILE_OPEN_ERROR(fp_logfile);
+    
+    /* Enter while loop to read fifo */
+    get_info_from_fifo(fp_logfile, log);
+    
+    result = fclose( fp_logfile);
+    FILE_CLOSE_ERROR(result);
+  }
   
-  result = fclose( fp_logfile);
+  result = logfile_close(&log);
   FILE_CLOSE_ERROR(result);
   
-  DEBUG_PRINT("fifo reader exit!\n");
+  DEBUG_PRINT("log reader exit!\n");
   exit(exit_code); 
 }
 
-void get_info_from_fifo(char buf[MAX], FILE * fp_fifo, FILE * fp_log){
-  char *str_result, *send_buf;
-  time_t timestamp;
-  int result, sequence_num = 0;
-  do 
+void get_info_from_fifo(FILE * fp_fifo, logfile_t * log){
+  log_event_t ev;
+  uint32_t sequence_num = 0;
+  
+  while ( log_event_read(fp_fifo, &ev) )
+  { 
+    write_event(log, &ev, &sequence_num);
+  }
+}
+
+void get_info_from_ring(logring_t * ring, pid_t gateway_pid, logfile_t * log){
+  log_event_t ev;
+  uint32_t sequence_num = 0;
+  uint64_t dropped, dropped_logged = 0;
+  int state;
+  
+  while ( (state = logring_pop(ring, &ev, RING_POLL_MS)) != LOGRING_CLOSED )
   {
-    str_result = fgets(buf, MAX, fp_fifo);
-    if ( str_result != NULL )
-    { 
-      printf("Message received: %s", buf); 
-      /* puts the message to gateway.log */
-      ASPRINTF_ERROR(asprintf( &send_buf, "%d %ld %s\n",  sequence_num, (long int)(time(&timestamp)), buf));
-      sequence_num++;
-      
-      result = fputs( send_buf, fp_log );
-      FILE_PUTS_ERROR(result);
-      DEBUG_PRINT("puts message %s to gateway.log\n", send_buf);
-      FFLUSH_ERROR(fflush(fp_log));
-      free( send_buf );
-      sleep(1);
-      }
-  } while ( str_result != NULL ); 
+    if(state == LOGRING_EVENT)write_event(log, &ev, &sequence_num);
+    
+    /* overflow is only counted by the producers, report it once the ring has room again */
+    dropped = logring_dropped(ring);
+    if(dropped != dropped_logged && (state == LOGRING_EMPTY || sequence_num % 1024 == 0)){
+      log_event_t lost = { .type = LOG_EV_EVENTS_DROPPED, .value = (double)(dropped - dropped_logged) };
+      write_event(log, &lost, &sequence_num);
+      dropped_logged = dropped;
+    }
+    
+    /* the gateway died without closing the ring */
+    if(state == LOGRING_EMPTY && getppid() != gateway_pid)break;
+  }
+}
+
+void write_event(logfile_t * log, log_event_t * ev, uint32_t * sequence_num){
+  int result;
+  ev->seq = (*sequence_num)++;
+  ev->ts = (int64_t)time(NULL);
+  if(gw_config.log_format == LOG_FORMAT_TEXT){
+    char msg[LOG_MSG_MAX];
+    log_event_format(ev, msg, sizeof(msg));
+    printf("Message received: %s\n", msg); 
+  }
+  
+  /* puts the message to the gateway log, rotating it when it is due */
+  result = logfile_write( log, ev );
+  FILE_PUTS_ERROR(result);
 }
 
 void final_message(void) 
@@ -230,8 +324,12 @@ void final_message(void)
 
 void print_help(void)
 {
-  printf("Use this program with 2 command line options: \n");
+  printf("Use this program as: gateway [-c config file] [-o key=value ...] 'server port'\n");
   printf("\t%-15s : TCP server port number\n", "\'server port\'");
+  printf("\t%-15s : read settings from this file ('key = value' lines)\n", "-c file");
+  printf("\t%-15s : override one setting, may be repeated\n", "-o key=value");
+  printf("Settings and their defaults:\n");
+  gwconfig_print(stdout);
 }
 
 int callback_func(void *data, int argc, char **argv, char **azColName){
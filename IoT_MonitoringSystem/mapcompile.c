@@ -0,0 +1,57 @@
+#define _GNU_SOURCE
+/*-----------------------------------------------------------------------------
+		include files
+------------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "errmacros.h"
+#include "mapfile.h"
+
+/*------------------------------------------------------------------------------
+		function declarations
+------------------------------------------------------------------------------*/
+void       print_help               (void);
+
+/*------------------------------------------------------------------------------
+		implementation code
+------------------------------------------------------------------------------*/
+int main( int argc, char *argv[] ){
+  mapfile_t map;
+  uint32_t written;
+  FILE * fp_text;
+  int result;
+
+  if(argc != 3){
+    print_help();
+    exit(EXIT_FAILURE);
+  }
+
+  fp_text = fopen(argv[1], "r");
+  FILE_OPEN_ERROR(fp_text);
+  /* compiling a compiled map again is harmless, it is read back and rewritten */
+  result = mapfile_open(fileno(fp_text), &map);
+  if(result == MAPFILE_NOT_BINARY)result = mapfile_parse_text(fp_text, &map);
+  if(result != MAPFILE_OK){
+    fprintf(stderr, "Can't read sensor map %s\n", argv[1]);
+    exit(EXIT_FAILURE);
+  }
+  FILE_CLOSE_ERROR(fclose(fp_text));
+
+  if(mapfile_write(argv[2], &map, &written) != MAPFILE_OK){
+    fprintf(stderr, "Can't write compiled sensor map %s\n", argv[2]);
+    exit(EXIT_FAILURE);
+  }
+  printf("%s: %" PRIu32 " sensors compiled from %" PRIu32 " map entries\n", argv[2], written, map.count);
+  mapfile_close(&map);
+  return EXIT_SUCCESS;
+}
+
+void print_help(void)
+{
+  printf("Use this program to compile a text sensor map for fast gateway startup: mapcompile <room_sensor.map> <compiled map>\n");
+  printf("\tPoint sensor_map at the compiled file, the gateway also still reads text maps\n");
+}
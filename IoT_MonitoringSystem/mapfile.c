@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+/*-----------------------------------------------------------------------------
+		include files
+------------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "mapfile.h"
+#include "errmacros.h"
+
+/*------------------------------------------------------------------------------
+		definitions (defines, typedefs, ...)
+------------------------------------------------------------------------------*/
+#define MAP_LINE_LENGTH    128
+#define INITIAL_RECORDS     8
+#define SENSOR_ID_RANGE   (UINT16_MAX + 1)
+
+/*------------------------------------------------------------------------------
+		function declarations
+------------------------------------------------------------------------------*/
+static int          compare_sensor_id   (const void * a, const void * b);
+static uint32_t  records_checksum    (const mapfile_record_t * records, uint32_t count);
+
+/*------------------------------------------------------------------------------
+		implementation code
+------------------------------------------------------------------------------*/
+int mapfile_parse_text(FILE * fp, mapfile_t * map){
+  char line[MAP_LINE_LENGTH];
+  mapfile_record_t * records = NULL, * grown;
+  mapfile_record_t r;
+  uint32_t count = 0, capacity = 0;
+
+  while( fgets(line, sizeof(line), fp) != NULL ){
+    memset(&r, 0, sizeof(r));
+    int j = sscanf(line, "%hu %hu %hu %hu", &r.room_id, &r.sensor_id, &r.floor_id, &r.building_id);
+    if(j < 2)continue;
+    r.columns = j;
+    if(count == capacity){
+      capacity = capacity ? capacity * 2 : INITIAL_RECORDS;
+      grown = realloc(records, capacity * sizeof(mapfile_record_t));
+      if(grown == NULL){
+        free(records);
+        return MAPFILE_ERROR;
+      }
+      records = grown;
+    }
+    records[count++] = r;
+  }
+  if(ferror(fp)){
+    free(records);
+    return MAPFILE_ERROR;
+  }
+  map->records = records;
+  map->count = count;
+  map->base = NULL;
+  map->length = 0;
+  return MAPFILE_OK;
+}
+
+int mapfile_open(int fd, mapfile_t * map){
+  const mapfile_header_t * header;
+  struct stat st;
+  void * base;
+
+  /* streams without a regular file behind them (pipes, memory streams) can only hold text */
+  if(fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))return MAPFILE_NOT_BINARY;
+  if((size_t)st.st_size < sizeof(mapfile_header_t))return MAPFILE_NOT_BINARY;
+  base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(base == MAP_FAILED){
+    perror("mmap of the sensor map failed");
+    return MAPFILE_ERROR;
+  }
+  header = base;
+  if(header->magic != MAPFILE_MAGIC){
+    munmap(base, st.st_size);
+    return MAPFILE_NOT_BINARY;
+  }
+  if(header->version != MAPFILE_VERSION || header->record_size != sizeof(mapfile_record_t)){
+    fprintf(stderr, "unsupported compiled sensor map version %u (record size %u)\n", header->version, header->record_size);
+    munmap(base, st.st_size);
+    return MAPFILE_ERROR;
+  }
+  map->records = (const mapfile_record_t *)(header + 1);
+  map->count = header->count;
+  if((size_t)st.st_size != sizeof(mapfile_header_t) + (size_t)map->count * sizeof(mapfile_record_t)
+     || records_checksum(map->records, map->count) != header->checksum){
+    fprintf(stderr, "compiled sensor map is truncated or corrupt\n");
+    munmap(base, st.st_size);
+    return MAPFILE_ERROR;
+  }
+  map->base = base;
+  map->length = st.st_size;
+  return MAPFILE_OK;
+}
+
+int mapfile_write(const char * path, mapfile_t * map, uint32_t * written){
+  mapfile_header_t header = { .magic = MAPFILE_MAGIC, .version = MAPFILE_VERSION, .record_size = sizeof(mapfile_record_t) };
+  mapfile_record_t * records = malloc(map->count * sizeof(mapfile_record_t) + 1);
+  bool * seen = calloc(SENSOR_ID_RANGE, sizeof(bool));
+  char * tmp_path;
+  FILE * fp;
+  uint32_t i;
+  int result = MAPFILE_OK;
+
+  if(records == NULL || seen == NULL){
+    free(records);
+    free(seen);
+    return MAPFILE_ERROR;
+  }
+  /* the first mapping of a sensor wins, as it does for a text map; the ids are unique after this so any sort will do */
+  for(i = 0; i != map->count; i++){
+    if(seen[map->records[i].sensor_id])continue;
+    seen[map->records[i].sensor_id] = true;
+    records[header.count++] = map->records[i];
+  }
+  free(seen);
+  qsort(records, header.count, sizeof(mapfile_record_t), compare_sensor_id);
+  header.checksum = records_checksum(records, header.count);
+
+  ASPRINTF_ERROR(asprintf(&tmp_path, "%s.tmp", path));
+  fp = fopen(tmp_path, "wb");
+  if(fp == NULL
+     || fwrite(&header, sizeof(header), 1, fp) != 1
+     || fwrite(records, sizeof(mapfile_record_t), header.count, fp) != header.count
+     || fflush(fp) != 0 || fsync(fileno(fp)) == -1){
+    perror(tmp_path);
+    result = MAPFILE_ERROR;
+  }
+  if(fp != NULL && fclose(fp) != 0)result = MAPFILE_ERROR;
+  if(result == MAPFILE_OK && rename(tmp_path, path) == -1){
+    perror(path);
+    result = MAPFILE_ERROR;
+  }
+  if(result != MAPFILE_OK)unlink(tmp_path);
+  else if(written != NULL)*written = header.count;
+  free(tmp_path);
+  free(records);
+  return result;
+}
+
+void mapfile_close(mapfile_t * map){
+  if(map->base != NULL)munmap(map->base, map->length);
+  else free((void *)map->records);
+  map->records = NULL;
+  map->base = NULL;
+  map->count = 0;
+  map->length = 0;
+}
+
+static int compare_sensor_id(const void * a, const void * b){
+  const mapfile_record_t * x = a, * y = b;
+  return (int)x->sensor_id - (int)y->sensor_id;
+}
+
+static uint32_t records_checksum(const mapfile_record_t * records, uint32_t count){
+  /* at most one record per sensor id, well within the uInt length of crc32 */
+  return (uint32_t)crc32(crc32(0L, Z_NULL, 0), (const Bytef *)records, count * sizeof(mapfile_record_t));
+}
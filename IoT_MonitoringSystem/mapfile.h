@@ -0,0 +1,72 @@
+#ifndef _MAPFILE_H_
+#define _MAPFILE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Compiled sensor map, written by mapcompile and memory mapped by datamgr:
+ *   mapfile_header_t, followed by 'count' mapfile_record_t sorted by sensor id, one per sensor
+ * Fields are in host byte order, compile the map on the gateway host
+ * The checksum is the CRC-32 of the records
+ */
+#define MAPFILE_MAGIC       0x4d535747u    // "GWSM"
+#define MAPFILE_VERSION     1
+
+#define MAPFILE_OK            0
+#define MAPFILE_NOT_BINARY    1             // no compiled map header, read the file as text
+#define MAPFILE_ERROR        -1
+
+typedef struct{
+  uint32_t          magic;
+  uint16_t          version;
+  uint16_t          record_size;
+  uint32_t          count;
+  uint32_t          checksum;
+}mapfile_header_t;
+
+typedef struct{
+  uint16_t          sensor_id;
+  uint16_t          room_id;
+  uint16_t          floor_id;
+  uint16_t          building_id;
+  uint8_t            columns;       // columns of the map line: 2 (no floor), 3 (no building) or 4
+  uint8_t            reserved;
+}mapfile_record_t;
+
+typedef struct{
+  const mapfile_record_t *  records;
+  uint32_t                          count;
+  void *                              base;           // the mapping, NULL for records read from a text map
+  size_t                              length;
+}mapfile_t;
+
+/*
+ * Reads the 'room_id sensor_id [floor_id [building_id]]' lines of a text map into 'map', in file order
+ * Lines with less than two numbers are skipped, a sensor may appear more than once
+ * Returns MAPFILE_OK, or MAPFILE_ERROR if the file can't be read
+ */
+int mapfile_parse_text(FILE * fp, mapfile_t * map);
+
+/*
+ * Maps the compiled map open on 'fd' read-only and checks its header, size and checksum
+ * Returns MAPFILE_OK, MAPFILE_NOT_BINARY if the file doesn't start with a compiled map header,
+ * or MAPFILE_ERROR if it is truncated, corrupt or of another version (reported on stderr)
+ */
+int mapfile_open(int fd, mapfile_t * map);
+
+/*
+ * Sorts the records of 'map' by sensor id, keeping the first record of every sensor,
+ * and writes them to 'path' as a compiled map (through a temporary file and rename, so readers never see half a map)
+ * Unless 'written' is NULL it receives the number of records in the file, the count in its header
+ * Returns MAPFILE_OK, or MAPFILE_ERROR if the file can't be written
+ */
+int mapfile_write(const char * path, mapfile_t * map, uint32_t * written);
+
+/*
+ * Releases the records of 'map', unmapping them if they came from mapfile_open
+ */
+void mapfile_close(mapfile_t * map);
+
+#endif /* _MAPFILE_H_ */
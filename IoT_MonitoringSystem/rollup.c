@@ -0,0 +1,173 @@
+#define _GNU_SOURCE
+/*-----------------------------------------------------------------------------
+		include files
+------------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "rollup.h"
+#include "errmacros.h"
+
+/*------------------------------------------------------------------------------
+		definitions (defines, typedefs, ...)
+------------------------------------------------------------------------------*/
+#define GROUP_ID_RANGE   (UINT16_MAX + 1)
+#define INITIAL_GROUPS    8
+
+typedef struct{
+  uint16_t              id;
+  int                       members;             // sensors in the map
+  int                       ready;                 // members with a running average
+  double                  sum;                   // sum of those running averages
+  alarm_t                alarm;
+  pthread_mutex_t  lock;                  // members are owned by different workers
+}rollup_group_t;
+
+typedef struct{
+  rollup_group_t ** groups;              // slot - 1 indexes this array, groups are allocated one by one so their locks never move
+  int                       count;
+  int                       capacity;
+  uint32_t *             index;                 // group id -> slot, ROLLUP_NONE if unknown
+}rollup_table_t;
+
+struct rollup_set{
+  rollup_table_t      tables[ROLLUP_LEVELS];
+};
+
+/*------------------------------------------------------------------------------
+		implementation code
+------------------------------------------------------------------------------*/
+rollup_set_t * rollup_create(void){
+  rollup_set_t * set = calloc(1, sizeof(rollup_set_t));
+  assert(set != NULL);
+  return set;
+}
+
+uint32_t rollup_add_member(rollup_set_t * set, rollup_level_t level, uint16_t id){
+  rollup_table_t * t = &set->tables[level];
+  rollup_group_t * g;
+  int presult;
+
+  if(t->index == NULL){
+    t->index = calloc(GROUP_ID_RANGE, sizeof(uint32_t));
+    assert(t->index != NULL);
+  }
+  if(t->index[id] == ROLLUP_NONE){
+    if(t->count == t->capacity){
+      /* only grows while the set is built, before it is published to the workers */
+      t->capacity = t->capacity ? t->capacity * 2 : INITIAL_GROUPS;
+      t->groups = realloc(t->groups, t->capacity * sizeof(rollup_group_t *));
+      assert(t->groups != NULL);
+    }
+    g = malloc(sizeof(rollup_group_t));
+    assert(g != NULL);
+    t->groups[t->count] = g;
+    g->id = id;
+    g->members = 0;
+    g->ready = 0;
+    g->sum = 0;
+    g->alarm = (alarm_t){ ALARM_NORMAL };
+    presult = pthread_mutex_init(&g->lock, NULL);
+    ERROR_HANDLER(presult);
+    t->index[id] = ++t->count;
+  }
+  t->groups[t->index[id] - 1]->members++;
+  return t->index[id];
+}
+
+sensor_value_t rollup_update(rollup_set_t * set, rollup_level_t level, uint32_t slot, sensor_value_t old_avg, sensor_value_t new_avg, bool first){
+  rollup_group_t * g = set->tables[level].groups[slot - 1];
+  sensor_value_t avg;
+  int presult;
+
+  presult = pthread_mutex_lock(&g->lock);
+  ERROR_HANDLER(presult);
+  if(first){
+    g->ready++;
+    g->sum += new_avg;
+  }
+  else{
+    g->sum += new_avg - old_avg;
+  }
+  /* a group with one ready member has no accumulated rounding error to carry */
+  if(g->ready == 1)g->sum = new_avg;
+  avg = g->sum / g->ready;
+  presult = pthread_mutex_unlock(&g->lock);
+  ERROR_HANDLER(presult);
+  return avg;
+}
+
+bool rollup_check_alarm(rollup_set_t * set, rollup_level_t level, uint32_t slot, sensor_ts_t ts,
+                        double min, double max, alarm_state_t * report, sensor_value_t * avg){
+  rollup_group_t * g = set->tables[level].groups[slot - 1];
+  bool result = false;
+  int presult;
+
+  presult = pthread_mutex_lock(&g->lock);
+  ERROR_HANDLER(presult);
+  if(g->ready != 0){
+    *avg = g->sum / g->ready;
+    result = alarm_update(&g->alarm, *avg, ts, min, max, report);
+  }
+  presult = pthread_mutex_unlock(&g->lock);
+  ERROR_HANDLER(presult);
+  return result;
+}
+
+void rollup_inherit_alarms(rollup_set_t * set, rollup_set_t * from){
+  int level, i, presult;
+  for(level = 0; level != ROLLUP_LEVELS; level++){
+    rollup_table_t * t = &set->tables[level];
+    rollup_table_t * old = &from->tables[level];
+    for(i = 0; i != old->count; i++){
+      rollup_group_t * g = old->groups[i];
+      if(t->index == NULL || t->index[g->id] == ROLLUP_NONE)continue;
+      presult = pthread_mutex_lock(&g->lock);
+      ERROR_HANDLER(presult);
+      t->groups[t->index[g->id] - 1]->alarm = g->alarm;
+      presult = pthread_mutex_unlock(&g->lock);
+      ERROR_HANDLER(presult);
+    }
+  }
+}
+
+sensor_value_t rollup_get_avg(rollup_set_t * set, rollup_level_t level, uint16_t id){
+  rollup_table_t * t = &set->tables[level];
+  rollup_group_t * g;
+  sensor_value_t avg;
+  int presult;
+
+  if(t->index == NULL || t->index[id] == ROLLUP_NONE)return -1;
+  g = t->groups[t->index[id] - 1];
+  presult = pthread_mutex_lock(&g->lock);
+  ERROR_HANDLER(presult);
+  avg = g->ready ? g->sum / g->ready : NAN;
+  presult = pthread_mutex_unlock(&g->lock);
+  ERROR_HANDLER(presult);
+  return avg;
+}
+
+int rollup_count(rollup_set_t * set, rollup_level_t level){
+  return set->tables[level].count;
+}
+
+void rollup_free(rollup_set_t ** set){
+  int level, i;
+  if(set == NULL || *set == NULL)return;
+  for(level = 0; level != ROLLUP_LEVELS; level++){
+    rollup_table_t * t = &(*set)->tables[level];
+    for(i = 0; i != t->count; i++){
+      pthread_mutex_destroy(&t->groups[i]->lock);
+      free(t->groups[i]);
+    }
+    free(t->groups);
+    free(t->index);
+  }
+  free(*set);
+  *set = NULL;
+}
@@ -0,0 +1,71 @@
+#ifndef _ROLLUP_H_
+#define _ROLLUP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+#include "alarm.h"
+
+/*
+ * Rolling averages of groups of sensors: rooms, and floors and buildings when the sensor map has those columns
+ * A group's average is the mean of the running averages of its sensors that have one,
+ * kept as a sum that is adjusted with each change of a member's running average, O(1) per reading
+ * Every version of the sensor map has its own rollup set
+ */
+typedef enum{
+  ROLLUP_ROOM = 0,
+  ROLLUP_FLOOR,
+  ROLLUP_BUILDING,
+  ROLLUP_LEVELS
+}rollup_level_t;
+
+#define ROLLUP_NONE 0           // group slot of a sensor that has no floor or building
+
+typedef struct rollup_set rollup_set_t;
+
+/*
+ * Returns a new, empty rollup set
+ */
+rollup_set_t * rollup_create(void);
+
+/*
+ * Registers one more member sensor of group 'id' while the sensor map is read, creating the group if needed
+ * Returns the group slot (never ROLLUP_NONE) to pass to rollup_update
+ */
+uint32_t rollup_add_member(rollup_set_t * set, rollup_level_t level, uint16_t id);
+
+/*
+ * Replaces a member's running average 'old_avg' by 'new_avg' in group 'slot', or adds it if 'first' is true
+ * Safe to call from several datamgr workers at once
+ * Returns the new average of the group
+ */
+sensor_value_t rollup_update(rollup_set_t * set, rollup_level_t level, uint32_t slot, sensor_value_t old_avg, sensor_value_t new_avg, bool first);
+
+/*
+ * Feeds the current average of group 'slot' to its alarm (see alarm_update), under the group lock
+ * Returns true and the state to report in '*report' and the average in '*avg' if there is something to report
+ */
+bool rollup_check_alarm(rollup_set_t * set, rollup_level_t level, uint32_t slot, sensor_ts_t ts,
+                        double min, double max, alarm_state_t * report, sensor_value_t * avg);
+
+/*
+ * Copies the alarm state of every group of 'from' to the group with the same id in 'set', if there is one
+ */
+void rollup_inherit_alarms(rollup_set_t * set, rollup_set_t * from);
+
+/*
+ * Returns the average of group 'id', NAN if none of its sensors has a running average yet, or -1 if there is no such group
+ */
+sensor_value_t rollup_get_avg(rollup_set_t * set, rollup_level_t level, uint16_t id);
+
+/*
+ * Returns the number of groups of 'level'
+ */
+int rollup_count(rollup_set_t * set, rollup_level_t level);
+
+/*
+ * Frees all groups and the set itself
+ */
+void rollup_free(rollup_set_t ** set);
+
+#endif /* _ROLLUP_H_ */
@@ -19,7 +19,9 @@ struct sbuffer
   sbuffer_node_t * head;
   sbuffer_node_t * tail;
   int buffer_size;
+  int closed;
   pthread_mutex_t lock;
+  pthread_cond_t not_empty;   // signalled by sbuffer_insert and sbuffer_close
 };
 
 void pthread_err_handler( int err_code, char *msg, char *file_name, char line_nr )
@@ -38,8 +40,11 @@ int sbuffer_init(sbuffer_t ** buffer)
   (*buffer)->head = NULL;
   (*buffer)->tail = NULL;
   (*buffer)->buffer_size = 0;
+  (*buffer)->closed = 0;
   presult = pthread_mutex_init(&((*buffer)->lock), NULL);
   pthread_err_handler( presult, "pthread_mutex_init", __FILE__, __LINE__ );
+  presult = pthread_cond_init(&((*buffer)->not_empty), NULL);
+  pthread_err_handler( presult, "pthread_cond_init", __FILE__, __LINE__ );
   return SBUFFER_SUCCESS; 
 }
 
@@ -49,6 +54,8 @@ int sbuffer_free(sbuffer_t ** buffer)
   int presult;
   presult = pthread_mutex_destroy( &((*buffer)->lock) );
   pthread_err_handler( presult, "pthread_mutex_destroy", __FILE__, __LINE__ );
+  presult = pthread_cond_destroy( &((*buffer)->not_empty) );
+  pthread_err_handler( presult, "pthread_cond_destroy", __FILE__, __LINE__ );
   
   if ((buffer==NULL) || (*buffer==NULL)) 
   {
@@ -110,25 +117,31 @@ int sbuffer_remove(sbuffer_t * buffer,sbuffer_data_t * data)
 int sbuffer_remove_block(sbuffer_t * buffer,sbuffer_data_t * data, int timeout){
   int presult;
   sbuffer_node_t * dummy;
-  time_t block_time;
-  time_t current_time;
+  struct timespec deadline;
   
   if (buffer == NULL) return SBUFFER_FAILURE;
   
-  if (buffer->head == NULL){
-    int loop = 1;
-    time(&block_time);
-    while(loop){
-      usleep(1000000);
-      time(&current_time);
-      if(sbuffer_size(buffer) != 0 )break;
-      if(buffer->buffer_size ==0 && difftime(current_time, block_time) >= (double)timeout)return SBUFFER_NO_DATA;
-    }
-  }
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout;
   
   presult = pthread_mutex_lock( &(buffer->lock) );
   pthread_err_handler( presult, "pthread_mutex_lock", __FILE__, __LINE__ );
   
+  /* sleep until an insert (or close) signals, instead of polling */
+  while (buffer->head == NULL){
+    if (buffer->closed){
+      presult = pthread_mutex_unlock( &(buffer->lock) );
+      pthread_err_handler( presult, "pthread_mutex_unlock", __FILE__, __LINE__ );
+      return SBUFFER_CLOSED;
+    }
+    presult = pthread_cond_timedwait( &(buffer->not_empty), &(buffer->lock), &deadline );
+    if (presult == ETIMEDOUT && buffer->head == NULL){
+      presult = pthread_mutex_unlock( &(buffer->lock) );
+      pthread_err_handler( presult, "pthread_mutex_unlock", __FILE__, __LINE__ );
+      return SBUFFER_NO_DATA;
+    }
+  }
+  
   *data = *(buffer->head->data);
   dummy = buffer->head;
   if (buffer->head == buffer->tail) // buffer has only one node
@@ -150,6 +163,59 @@ int sbuffer_remove_block(sbuffer_t * buffer,sbuffer_data_t * data, int timeout){
   return SBUFFER_SUCCESS;
 }
 
+int sbuffer_remove_batch(sbuffer_t * buffer, sbuffer_data_t * data, int max, int * count, const struct timespec * deadline){
+  int presult;
+  sbuffer_node_t * dummy;
+  
+  *count = 0;
+  if (buffer == NULL) return SBUFFER_FAILURE;
+  
+  presult = pthread_mutex_lock( &(buffer->lock) );
+  pthread_err_handler( presult, "pthread_mutex_lock", __FILE__, __LINE__ );
+  
+  while (buffer->head == NULL){
+    if (buffer->closed){
+      presult = pthread_mutex_unlock( &(buffer->lock) );
+      pthread_err_handler( presult, "pthread_mutex_unlock", __FILE__, __LINE__ );
+      return SBUFFER_CLOSED;
+    }
+    presult = pthread_cond_timedwait( &(buffer->not_empty), &(buffer->lock), deadline );
+    if (presult == ETIMEDOUT && buffer->head == NULL){
+      presult = pthread_mutex_unlock( &(buffer->lock) );
+      pthread_err_handler( presult, "pthread_mutex_unlock", __FILE__, __LINE__ );
+      return SBUFFER_NO_DATA;
+    }
+  }
+  
+  /* everything that is there, up to 'max', under one lock */
+  while (buffer->head != NULL && *count != max){
+    data[(*count)++] = *(buffer->head->data);
+    dummy = buffer->head;
+    buffer->head = buffer->head->next;
+    if (buffer->head == NULL) buffer->tail = NULL;
+    buffer->buffer_size--;
+    free(dummy->data);
+    free(dummy);
+  }
+  
+  presult = pthread_mutex_unlock( &(buffer->lock) );
+  pthread_err_handler( presult, "pthread_mutex_unlock", __FILE__, __LINE__ );
+  
+  return SBUFFER_SUCCESS;
+}
+
+void sbuffer_close(sbuffer_t * buffer){
+  int presult;
+  
+  presult = pthread_mutex_lock( &(buffer->lock) );
+  pthread_err_handler( presult, "pthread_mutex_lock", __FILE__, __LINE__ );
+  buffer->closed = 1;
+  presult = pthread_cond_broadcast( &(buffer->not_empty) );
+  pthread_err_handler( presult, "pthread_cond_broadcast", __FILE__, __LINE__ );
+  presult = pthread_mutex_unlock( &(buffer->lock) );
+  pthread_err_handler( presult, "pthread_mutex_unlock", __FILE__, __LINE__ );
+}
+
 
 /* Inserts the data in 'data' at the end of 'buffer' (at the 'tail')
  * Returns SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occured
@@ -181,6 +247,8 @@ int sbuffer_insert(sbuffer_t * buffer, sbuffer_data_t * data)
     buffer->tail = buffer->tail->next; 
     buffer->buffer_size++;
   }
+  presult = pthread_cond_signal( &(buffer->not_empty) );
+  pthread_err_handler( presult, "pthread_cond_signal", __FILE__, __LINE__ );
   
   presult = pthread_mutex_unlock( &(buffer->lock) );
   pthread_err_handler( presult, "pthread_mutex_unlock", __FILE__, __LINE__ );
@@ -3,10 +3,12 @@
 
 #include "config.h"
 #include "errmacros.h"
+#include <time.h>
 
 #define SBUFFER_FAILURE -1
 #define SBUFFER_SUCCESS 0
 #define SBUFFER_NO_DATA 1
+#define SBUFFER_CLOSED 2
 
 typedef struct sbuffer sbuffer_t;
 
@@ -43,8 +45,26 @@ int sbuffer_free(sbuffer_t ** buffer);
  */
 int sbuffer_remove(sbuffer_t * buffer, sbuffer_data_t * data);
 
+/*
+ * Like sbuffer_remove, but if 'buffer' is empty it blocks until new data is inserted or 'timeout' seconds have passed
+ * Returns SBUFFER_SUCCESS on success, SBUFFER_NO_DATA on timeout, SBUFFER_CLOSED if 'buffer' is closed and empty
+ * and SBUFFER_FAILURE if an error occured
+ */
 int sbuffer_remove_block(sbuffer_t * buffer,sbuffer_data_t * data, int timeout);
 
+/*
+ * Removes up to 'max' data from 'buffer' into 'data[0 .. *count - 1]', taking one lock for all of them
+ * If 'buffer' is empty it blocks until new data is inserted or the absolute CLOCK_REALTIME 'deadline' has passed
+ * Returns SBUFFER_SUCCESS if at least one was removed, SBUFFER_NO_DATA at the deadline, SBUFFER_CLOSED if 'buffer'
+ * is closed and empty and SBUFFER_FAILURE if an error occured
+ */
+int sbuffer_remove_batch(sbuffer_t * buffer, sbuffer_data_t * data, int max, int * count, const struct timespec * deadline);
+
+/*
+ * Marks the end of the data: once 'buffer' is drained, blocked and later sbuffer_remove_block calls return SBUFFER_CLOSED
+ */
+void sbuffer_close(sbuffer_t * buffer);
+
 /* Inserts the data in 'data' at the end of 'buffer' (at the 'tail')
  * Returns SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occured
 */
@@ -11,23 +11,120 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "sensor_db.h"
 #include "connmgr.h"
 #include "config.h"
+#include "logevent.h"
+#include "gwconfig.h"
 
 /*------------------------------------------------------------------------------
 		definitions (defines, typedefs, ...)
 ------------------------------------------------------------------------------*/
 #define LOOP_TIME 5
+#define TABLE         TO_STRING(TABLE_NAME)
+#define COLUMNS     4                       // of TABLE, as returned by SELECT *
+
+#define TABLE_COLUMNS  "(id INTEGER PRIMARY KEY AUTOINCREMENT, " \
+                                     "sensor_id             INT                      NOT NULL, " \
+                                     "sensor_value       DECIMAL(4,2)     NOT NULL, " \
+                                     "timestamp           TIMESTAMP        NOT NULL);"
+
+/* every query filters on one of these, so none of them scans the table; the rowid at the end of each keeps arrival order */
+#define TABLE_INDEXES  "CREATE INDEX IF NOT EXISTS " TABLE "_sensor_time ON " TABLE " (sensor_id, timestamp); " \
+                                     "CREATE INDEX IF NOT EXISTS " TABLE "_time ON " TABLE " (timestamp); " \
+                                     "CREATE INDEX IF NOT EXISTS " TABLE "_value ON " TABLE " (sensor_value);"
+
+typedef enum{
+  STMT_INSERT = 0,
+  STMT_BEGIN,
+  STMT_COMMIT,
+  STMT_ROLLBACK,
+  STMT_FIND_ALL,
+  STMT_FIND_BY_VALUE,
+  STMT_FIND_EXCEED_VALUE,
+  STMT_FIND_BY_TIMESTAMP,
+  STMT_FIND_AFTER_TIMESTAMP,
+  STMT_QUERY_SENSOR,
+  STMT_QUERY_RANGE,
+  STMT_COUNT
+}db_statement_t;
+
+/*
+ * A database connection with every statement sensor_db runs prepared once, when the connection is made
+ * Parameters are bound for each use and the statement is reset afterwards, nothing is parsed or formatted per row
+ */
+struct dbconn{
+  sqlite3 *            db;
+  sqlite3_stmt *     stmt[STMT_COUNT];
+  bool                   in_use[STMT_COUNT];  // by an open cursor
+  
+  /* background checkpointer of the WAL profiles, with a connection of its own */
+  sqlite3 *            checkpoint_db;        // NULL if there is no checkpointer
+  pthread_t           checkpoint_thread;
+  pthread_mutex_t  checkpoint_lock;
+  pthread_cond_t    checkpoint_cond;
+  bool                   checkpoint_due;       // set by the WAL hook of the writer
+  bool                   checkpoint_stop;
+  atomic_int           checkpoint_copied;   // WAL pages copied into the database by the last checkpoint
+};
+
+static const char * const profile_pragmas[] = {
+  [DB_PROFILE_LEGACY] = "PRAGMA journal_mode=DELETE; PRAGMA synchronous=FULL;",
+  [DB_PROFILE_SAFE]     = "PRAGMA journal_mode=WAL; PRAGMA synchronous=FULL;",
+  [DB_PROFILE_NORMAL] = "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;",
+  [DB_PROFILE_FAST]     = "PRAGMA journal_mode=WAL; PRAGMA synchronous=OFF;",
+};
+
+static const char * const statement_sql[STMT_COUNT] = {
+  [STMT_INSERT]               = "INSERT INTO " TABLE " (sensor_id,sensor_value,timestamp) VALUES (?1, ?2, ?3);",
+  [STMT_BEGIN]                 = "BEGIN;",
+  [STMT_COMMIT]             = "COMMIT;",
+  [STMT_ROLLBACK]          = "ROLLBACK;",
+  [STMT_FIND_ALL]          = "SELECT * FROM " TABLE ";",
+  [STMT_FIND_BY_VALUE] = "SELECT * FROM " TABLE " WHERE sensor_value = ?1;",
+  [STMT_FIND_EXCEED_VALUE] = "SELECT * FROM " TABLE " WHERE sensor_value > ?1;",
+  [STMT_FIND_BY_TIMESTAMP] = "SELECT * FROM " TABLE " WHERE timestamp = ?1;",
+  [STMT_FIND_AFTER_TIMESTAMP] = "SELECT * FROM " TABLE " WHERE timestamp > ?1;",
+  [STMT_QUERY_SENSOR]   = "SELECT sensor_id, sensor_value, timestamp FROM " TABLE
+                                        " WHERE sensor_id = ?1 AND timestamp BETWEEN ?2 AND ?3 ORDER BY timestamp, id LIMIT ?4 OFFSET ?5;",
+  [STMT_QUERY_RANGE]    = "SELECT sensor_id, sensor_value, timestamp FROM " TABLE
+                                        " WHERE timestamp BETWEEN ?2 AND ?3 ORDER BY timestamp, id LIMIT ?4 OFFSET ?5;",
+};
+
+/* a query in progress on one of the connection's query statements */
+struct db_cursor{
+  DBCONN *             conn;
+  db_statement_t    which;
+  sqlite3_stmt *      stmt;
+  bool                    done;
+};
 
 /*------------------------------------------------------------------------------
 		global variable declarations
 ------------------------------------------------------------------------------*/
-extern sem_t fifo_sem;
-extern FILE  *fp; 
+static storagemgr_stats_t stats;
+static pthread_mutex_t      stats_lock = PTHREAD_MUTEX_INITIALIZER;
 
-extern void   log_to_fifo( char * buf, sem_t sema, FILE * fp_t );
+/*------------------------------------------------------------------------------
+		function declarations
+------------------------------------------------------------------------------*/
+static double      elapsed_ms          (const struct timespec * since);
+static void         commit_batch       (DBCONN * conn, const sbuffer_data_t * batch, int count, const struct timespec * first);
+static DBCONN *  connection_create (sqlite3 * db, const char * schema);
+static int           apply_profile        (sqlite3 * db);
+static long         insert_sensor_from_stream (DBCONN * conn, FILE * sensor_data);
+static int           insert_records       (DBCONN * conn, const unsigned char * records, size_t count);
+static int           checkpointer_start (DBCONN * conn);
+static void         checkpointer_stop  (DBCONN * conn);
+static void *      checkpointer         (void * arg);
+static int           wal_committed      (void * arg, sqlite3 * db, const char * name, int pages);
+static int           run_statement     (DBCONN * conn, db_statement_t which);
+static int           run_query           (DBCONN * conn, db_statement_t which, callback_t f);
 
 /*------------------------------------------------------------------------------
 		implementation code
@@ -37,36 +134,90 @@ extern void   log_to_fifo( char * buf, sem_t sema, FILE * fp_t );
  * When *buffer becomes NULL the method finishes. This method will NOT automatically disconnect from the db
  */
 void storagemgr_parse_sensor_data(DBCONN * conn, sbuffer_t ** buffer){
-  char * send_buf;
+  const int max = gw_config.storage_batch_size;
+  struct timespec deadline, first;
+  int count, more, state;
+  
   if(conn == NULL){
     #ifdef DEBUG
     fprintf(stderr, "Connection lost:\n");
     #endif
-    ASPRINTF_ERROR(asprintf( &send_buf, "Connection to SQL server lost"));
-    log_to_fifo( send_buf, fifo_sem, fp );
+    log_event( LOG_EV_DB_LOST, 0, 0 );
     
     conn = retry_connection();
   }
-  sbuffer_data_t * data_ptr = malloc(sizeof(sbuffer_data_t));
-  assert(data_ptr != NULL);
+  sbuffer_data_t * batch = malloc(max * sizeof(sbuffer_data_t));
+  assert(batch != NULL);
 
-  int loop = 1;
-  while( loop ){
-    int state =  sbuffer_remove_block( *buffer, data_ptr, TIMEOUT);
-    if(state == SBUFFER_NO_DATA)break;
+  while( true ){
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += gw_config.timeout;
+    state = sbuffer_remove_batch( *buffer, batch, max, &count, &deadline );
+    if(state == SBUFFER_NO_DATA || state == SBUFFER_CLOSED)break;
     else if (state == SBUFFER_FAILURE)ERROR_HANDLER(state); 
-    else{
-      int flag = insert_sensor( conn, data_ptr->sensor_data.id, data_ptr->sensor_data.value, data_ptr->sensor_data.ts);
-      if(flag == -1){
-	DEBUG_PRINT("An error occured during insert_sensor.\n");
-	exit(EXIT_FAILURE);
-      }
-      DEBUG_PRINT("Insert_sensor successed.\n");
-      /*force a context switch*/ 
-      usleep(500000);
+    
+    /* group commit: wait up to storage_linger_ms for more readings to share the transaction */
+    clock_gettime(CLOCK_MONOTONIC, &first);
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += gw_config.storage_linger_ms / 1000;
+    deadline.tv_nsec += (gw_config.storage_linger_ms % 1000) * 1000000L;
+    if(deadline.tv_nsec >= 1000000000L){
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
     }
+    while(count != max && sbuffer_remove_batch( *buffer, batch + count, max - count, &more, &deadline ) == SBUFFER_SUCCESS){
+      count += more;
+    }
+    commit_batch( conn, batch, count, &first );
   }
-  free(data_ptr);
+  free(batch);
+#ifdef DEBUG
+  storagemgr_stats_t totals;
+  storagemgr_get_stats(&totals);
+  DEBUG_PRINT("storagemgr committed %ld readings in %ld transactions\n", totals.rows, totals.batches);
+#endif
+}
+
+/* one transaction for the whole batch, so one journal sync instead of one per reading */
+static void commit_batch(DBCONN * conn, const sbuffer_data_t * batch, int count, const struct timespec * first){
+  int i, presult;
+  
+  if(run_statement(conn, STMT_BEGIN) != 0)exit(EXIT_FAILURE);
+  for(i = 0; i != count; i++){
+    if(insert_sensor( conn, batch[i].sensor_data.id, batch[i].sensor_data.value, batch[i].sensor_data.ts ) == -1){
+      DEBUG_PRINT("An error occured during insert_sensor.\n");
+      run_statement(conn, STMT_ROLLBACK);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if(run_statement(conn, STMT_COMMIT) != 0)exit(EXIT_FAILURE);
+  
+  double latency = elapsed_ms(first);
+  presult = pthread_mutex_lock(&stats_lock);
+  ERROR_HANDLER(presult);
+  stats.batches++;
+  stats.rows += count;
+  stats.last_batch = count;
+  if(count > stats.max_batch)stats.max_batch = count;
+  stats.last_latency_ms = latency;
+  if(latency > stats.max_latency_ms)stats.max_latency_ms = latency;
+  stats.total_latency_ms += latency;
+  presult = pthread_mutex_unlock(&stats_lock);
+  ERROR_HANDLER(presult);
+}
+
+static double elapsed_ms(const struct timespec * since){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since->tv_sec) * 1e3 + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+void storagemgr_get_stats(storagemgr_stats_t * out){
+  int presult = pthread_mutex_lock(&stats_lock);
+  ERROR_HANDLER(presult);
+  *out = stats;
+  presult = pthread_mutex_unlock(&stats_lock);
+  ERROR_HANDLER(presult);
 }
 
 /*
@@ -77,11 +228,10 @@ void storagemgr_parse_sensor_data(DBCONN * conn, sbuffer_t ** buffer){
  */
 DBCONN * init_connection(char clear_up_flag){
    sqlite3 *db;
-   char *zErrMsg = 0;
-   int rc, loop = LOOP_TIME;
-   char * sql, *send_buf;
+   DBCONN * conn;
+   int loop = LOOP_TIME;
    
-   while( sqlite3_open("DB_NAME", &db)){
+   while( sqlite3_open(gw_config.db_name, &db)){
       usleep(100000);
       fprintf(stderr, "Can't open database: %s, Still try %d times\n", sqlite3_errmsg(db), loop);
       loop--;
@@ -89,44 +239,23 @@ DBCONN * init_connection(char clear_up_flag){
 	#ifdef DEBUG
 	fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
 	#endif
-	ASPRINTF_ERROR(asprintf( &send_buf, "Unable to connect to SQL server"));
-	log_to_fifo( send_buf, fifo_sem, fp );
+	log_event( LOG_EV_DB_UNREACHABLE, 0, 0 );
 	exit(0);
       }
    }
    #ifdef DEBUG
    fprintf(stderr, "Opened database successfully\n");
    #endif
-   ASPRINTF_ERROR(asprintf( &send_buf, "Connection to SQL server established.\n"));
-   log_to_fifo( send_buf, fifo_sem, fp );
+   log_event( LOG_EV_DB_CONNECTED, 0, 0 );
    
    if(clear_up_flag == 1){
-             sql = "DROP TABLE IF EXISTS TABLE_NAME;"   
-                        "CREATE TABLE TABLE_NAME(" \
-		      "id INTEGER PRIMARY KEY      AUTOINCREMENT, " \
-		      "sensor_id             INT                      NOT NULL,"\
-		      "sensor_value       DECIMAL(4,2)     NOT NULL, " \
-		      "timestamp           TIMESTAMP        NOT NULL);"; 
-  }
-  else{ 
-                sql =  "CREATE TABLE TABLE_NAME(" \
-			  "id INT PRIMARY KEY      AUTOINCREMENT, " \
-			  "sensor_id             INT                      NOT NULL,"\
-			  "sensor_value       DECIMAL(4,2)     NOT NULL, " \
-			  "timestamp           TIMESTAMP        NOT NULL);"; 
-  }		
-      /* Execute SQL statement */
-   rc = sqlite3_exec(db, sql, 0, 0, &zErrMsg);
-   if( rc != SQLITE_OK ){
-      fprintf(stderr, "SQL error: %s\n", zErrMsg);
-      sqlite3_free(zErrMsg);
-      return NULL;
-   }else{
-      const char *str1 = "SensorData";
-      ASPRINTF_ERROR(asprintf( &send_buf, "New table %s created.\n", str1));
-      log_to_fifo( send_buf, fifo_sem, fp );
+      conn = connection_create(db, "DROP TABLE IF EXISTS " TABLE "; CREATE TABLE " TABLE TABLE_COLUMNS TABLE_INDEXES);
    }
-  return db;
+   else{
+      conn = connection_create(db, "CREATE TABLE IF NOT EXISTS " TABLE TABLE_COLUMNS TABLE_INDEXES);
+   }
+   if(conn != NULL)log_event( LOG_EV_DB_TABLE_CREATED, 0, 0 );
+   return conn;
 }
 
 /* 
@@ -134,33 +263,251 @@ DBCONN * init_connection(char clear_up_flag){
  */
 DBCONN * retry_connection(void){
    sqlite3 *db;
-   char * send_buf;
    int loop = LOOP_TIME;
    
-   while( sqlite3_open("DB_NAME", &db)){
+   while( sqlite3_open(gw_config.db_name, &db)){
       usleep(100000);
       fprintf(stderr, "Can't re_open database: %s, Still try %d times\n", sqlite3_errmsg(db), loop);
       loop--;
       if(loop == 0){
-	ASPRINTF_ERROR(asprintf( &send_buf, "Unable to connect to SQL server"));
-	log_to_fifo( send_buf, fifo_sem, fp );
+	log_event( LOG_EV_DB_UNREACHABLE, 0, 0 );
 	exit(0);
       }
    }
    #ifdef DEBUG
    fprintf(stderr, "Re_opened database successfully\n");
    #endif
-   ASPRINTF_ERROR(asprintf( &send_buf, "Connection to SQL server established."));
-   log_to_fifo( send_buf, fifo_sem, fp );
+   log_event( LOG_EV_DB_CONNECTED, 0, 0 );
+   
+   return connection_create(db, "CREATE TABLE IF NOT EXISTS " TABLE TABLE_COLUMNS TABLE_INDEXES);
+}
+
+/*
+ * Runs 'schema' on the open database 'db' and prepares every statement of the connection
+ * Returns the connection, or NULL (with 'db' closed) if an error occurs
+ */
+static DBCONN * connection_create(sqlite3 * db, const char * schema){
+   char *zErrMsg = 0;
+   int i;
+   
+   /* the page size has to be set before the schema creates the database file */
+   if(apply_profile(db) != 0){
+      sqlite3_close(db);
+      return NULL;
+   }
+   if(sqlite3_exec(db, schema, 0, 0, &zErrMsg) != SQLITE_OK){
+      fprintf(stderr, "SQL error: %s\n", zErrMsg);
+      sqlite3_free(zErrMsg);
+      sqlite3_close(db);
+      return NULL;
+   }
+   DBCONN * conn = calloc(1, sizeof(DBCONN));
+   assert(conn != NULL);
+   conn->db = db;
+   for(i = 0; i != STMT_COUNT; i++){
+      if(sqlite3_prepare_v2(db, statement_sql[i], -1, &conn->stmt[i], NULL) != SQLITE_OK){
+         fprintf(stderr, "SQL error: %s in %s\n", sqlite3_errmsg(db), statement_sql[i]);
+         disconnect(conn);
+         return NULL;
+      }
+   }
+   if(gw_config.db_profile != DB_PROFILE_LEGACY && checkpointer_start(conn) != 0){
+      disconnect(conn);
+      return NULL;
+   }
+   return conn;
+}
+
+/* sets the journal and sync mode of gw_config.db_profile, and the sizes of the WAL profiles */
+static int apply_profile(sqlite3 * db){
+   char *zErrMsg = 0;
+   char * sql;
+   int rc;
+   
+   sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
+   if(gw_config.db_profile == DB_PROFILE_LEGACY){
+      ASPRINTF_ERROR(asprintf(&sql, "%s", profile_pragmas[DB_PROFILE_LEGACY]));
+   }
+   else{
+      /* the checkpointer replaces the automatic checkpoints, which would run inside the writer's commits */
+      ASPRINTF_ERROR(asprintf(&sql, "PRAGMA page_size=%d; %s PRAGMA cache_size=-%d; PRAGMA mmap_size=%ld; PRAGMA wal_autocheckpoint=0;",
+                              gw_config.db_page_size, profile_pragmas[gw_config.db_profile], gw_config.db_cache_kib, gw_config.db_mmap_size));
+   }
+   rc = sqlite3_exec(db, sql, 0, 0, &zErrMsg);
+   free(sql);
+   if(rc != SQLITE_OK){
+      fprintf(stderr, "SQL error: %s\n", zErrMsg);
+      sqlite3_free(zErrMsg);
+      return -1;
+   }
+   return 0;
+}
+
+static int checkpointer_start(DBCONN * conn){
+   int presult;
    
-   return db;
+   /* a connection only finds the WAL once it has read the database */
+   if(sqlite3_open_v2(gw_config.db_name, &conn->checkpoint_db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK
+      || sqlite3_exec(conn->checkpoint_db, "PRAGMA journal_mode;", 0, 0, NULL) != SQLITE_OK){
+      fprintf(stderr, "Can't open database for the checkpointer: %s\n", sqlite3_errmsg(conn->checkpoint_db));
+      sqlite3_close(conn->checkpoint_db);
+      conn->checkpoint_db = NULL;
+      return -1;
+   }
+   presult = pthread_mutex_init(&conn->checkpoint_lock, NULL);
+   ERROR_HANDLER(presult);
+   presult = pthread_cond_init(&conn->checkpoint_cond, NULL);
+   ERROR_HANDLER(presult);
+   conn->checkpoint_due = false;
+   conn->checkpoint_stop = false;
+   atomic_init(&conn->checkpoint_copied, 0);
+   presult = pthread_create(&conn->checkpoint_thread, NULL, &checkpointer, conn);
+   ERROR_HANDLER(presult);
+   sqlite3_wal_hook(conn->db, &wal_committed, conn);
+   return 0;
+}
+
+/* the final checkpoint is left to sqlite3_close of the writer, the last connection to the database */
+static void checkpointer_stop(DBCONN * conn){
+   int presult;
+   
+   if(conn->checkpoint_db == NULL)return;
+   sqlite3_wal_hook(conn->db, NULL, NULL);
+   presult = pthread_mutex_lock(&conn->checkpoint_lock);
+   ERROR_HANDLER(presult);
+   conn->checkpoint_stop = true;
+   presult = pthread_cond_signal(&conn->checkpoint_cond);
+   ERROR_HANDLER(presult);
+   presult = pthread_mutex_unlock(&conn->checkpoint_lock);
+   ERROR_HANDLER(presult);
+   presult = pthread_join(conn->checkpoint_thread, NULL);
+   ERROR_HANDLER(presult);
+   pthread_cond_destroy(&conn->checkpoint_cond);
+   pthread_mutex_destroy(&conn->checkpoint_lock);
+   sqlite3_close(conn->checkpoint_db);
+   conn->checkpoint_db = NULL;
+}
+
+/*
+ * Called by SQLite after every commit of the writer, only takes the lock once db_checkpoint_pages pages wait to be copied
+ * Pages that readers keep in the WAL do not count again, so long reads do not turn every commit into a checkpoint
+ */
+static int wal_committed(void * arg, sqlite3 * db, const char * name, int pages){
+   DBCONN * conn = arg;
+   int copied = atomic_load_explicit(&conn->checkpoint_copied, memory_order_relaxed);
+   int presult;
+   
+   if(copied > pages)copied = 0;     // the WAL was rewound
+   if(pages - copied < gw_config.db_checkpoint_pages)return SQLITE_OK;
+   presult = pthread_mutex_lock(&conn->checkpoint_lock);
+   ERROR_HANDLER(presult);
+   conn->checkpoint_due = true;
+   presult = pthread_cond_signal(&conn->checkpoint_cond);
+   ERROR_HANDLER(presult);
+   presult = pthread_mutex_unlock(&conn->checkpoint_lock);
+   ERROR_HANDLER(presult);
+   return SQLITE_OK;
 }
 
 /*
- * Disconnect from the database server
+ * Copies the WAL back into the database when the writer reports it has grown, or every db_checkpoint_interval seconds
+ * The checkpoints never wait for the writer or for readers, pages that readers still need are left for the next one
+ */
+static void * checkpointer(void * arg){
+   DBCONN * conn = arg;
+   struct timespec deadline;
+   int wal_pages, copied, presult;
+   
+   presult = pthread_mutex_lock(&conn->checkpoint_lock);
+   ERROR_HANDLER(presult);
+   while(!conn->checkpoint_stop){
+      if(!conn->checkpoint_due){
+         if(gw_config.db_checkpoint_interval > 0){
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += gw_config.db_checkpoint_interval;
+            pthread_cond_timedwait(&conn->checkpoint_cond, &conn->checkpoint_lock, &deadline);
+         }
+         else pthread_cond_wait(&conn->checkpoint_cond, &conn->checkpoint_lock);
+         if(conn->checkpoint_stop)break;
+      }
+      conn->checkpoint_due = false;
+      presult = pthread_mutex_unlock(&conn->checkpoint_lock);
+      ERROR_HANDLER(presult);
+      
+      if(sqlite3_wal_checkpoint_v2(conn->checkpoint_db, NULL, SQLITE_CHECKPOINT_PASSIVE, &wal_pages, &copied) == SQLITE_OK){
+         /* a busy writer never sees the WAL fully copied, so rewind it here; without a busy handler this never waits */
+         if(wal_pages >= gw_config.db_checkpoint_pages && copied == wal_pages){
+            sqlite3_wal_checkpoint_v2(conn->checkpoint_db, NULL, SQLITE_CHECKPOINT_RESTART, &wal_pages, &copied);
+         }
+         atomic_store_explicit(&conn->checkpoint_copied, copied, memory_order_relaxed);
+         presult = pthread_mutex_lock(&stats_lock);
+         ERROR_HANDLER(presult);
+         stats.checkpoints++;
+         stats.wal_pages = wal_pages - copied;
+         presult = pthread_mutex_unlock(&stats_lock);
+         ERROR_HANDLER(presult);
+      }
+      
+      presult = pthread_mutex_lock(&conn->checkpoint_lock);
+      ERROR_HANDLER(presult);
+   }
+   presult = pthread_mutex_unlock(&conn->checkpoint_lock);
+   ERROR_HANDLER(presult);
+   return NULL;
+}
+
+/*
+ * Disconnect from the database server, and free all used memory
  */
 void disconnect(DBCONN *conn){
-  sqlite3_close(conn);
+  int i;
+  if(conn == NULL)return;
+  checkpointer_stop(conn);
+  for(i = 0; i != STMT_COUNT; i++)sqlite3_finalize(conn->stmt[i]);
+  sqlite3_close(conn->db);
+  free(conn);
+}
+
+/* steps a statement without result rows and resets it, returns zero for success */
+static int run_statement(DBCONN * conn, db_statement_t which){
+  sqlite3_stmt * stmt = conn->stmt[which];
+  int rc = sqlite3_step(stmt);
+  sqlite3_reset(stmt);
+  if(rc != SQLITE_DONE){
+    fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(conn->db));
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Steps a query with its parameters bound and calls 'f' for every row, like sqlite3_exec would
+ * The statement is reset and its bindings cleared afterwards, returns zero for success
+ */
+static int run_query(DBCONN * conn, db_statement_t which, callback_t f){
+  sqlite3_stmt * stmt = conn->stmt[which];
+  const char* data = "Callback function called";
+  char * values[COLUMNS], * names[COLUMNS];
+  int rc, i;
+  
+  while((rc = sqlite3_step(stmt)) == SQLITE_ROW){
+    for(i = 0; i != COLUMNS; i++){
+      values[i] = (char *)sqlite3_column_text(stmt, i);
+      names[i] = (char *)sqlite3_column_name(stmt, i);
+    }
+    if(f((void *)data, COLUMNS, values, names) != 0){
+      rc = SQLITE_ABORT;
+      break;
+    }
+  }
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+  if(rc != SQLITE_DONE){
+    fprintf(stderr, "SQL error: %s\n", rc == SQLITE_ABORT ? "query aborted by the callback" : sqlite3_errmsg(conn->db));
+    return -1;
+  }
+  fprintf(stdout, "Operation done successfully\n");
+  return 0;
 }
 
 /*
@@ -168,92 +515,177 @@ void disconnect(DBCONN *conn){
  * Return zero for success, and non-zero if an error occurs
  */
 int insert_sensor(DBCONN * conn, sensor_id_t id, sensor_value_t value, sensor_ts_t ts){
-  int rc;  
-  sqlite3_stmt *stmt; 
-  char * send_buf;
+  sqlite3_stmt * stmt;
   
   if(conn == NULL){
     #ifdef DEBUG
     fprintf(stderr, "Connection lost:\n");
     #endif
-    ASPRINTF_ERROR(asprintf( &send_buf, "Connection to SQL server lost"));
-    log_to_fifo( send_buf, fifo_sem, fp );
+    log_event( LOG_EV_DB_LOST, 0, 0 );
     
     conn = retry_connection();
   }
   
-  /* Create SQL statement */
-  char * sql = NULL;
-  int i = asprintf(&sql, "INSERT INTO TABLE_NAME (sensor_id,sensor_value,timestamp) values (%hd, %f, %ld);", id, value, (long int)ts);
-  if(i == -1){
-    fprintf(stdout, "There is an error occured on asprintf\n");
-    return -1;
-  }
-  sqlite3_prepare_v2(conn, sql, strlen(sql), &stmt, NULL);
-    
-   /* Execute SQL statement */
-   rc = sqlite3_step(stmt);
-   if( rc != SQLITE_DONE ){
-      fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(conn));
-      free(sql);
+  stmt = conn->stmt[STMT_INSERT];
+  sqlite3_bind_int(stmt, 1, id);
+  sqlite3_bind_double(stmt, 2, value);
+  sqlite3_bind_int64(stmt, 3, ts);
+  return run_statement(conn, STMT_INSERT);
+}
+
+/*
+ * Insert all sensor measurements available in the file 'sensor_data', gw_config.import_batch_size rows per transaction
+ * The file is read through mmap when it is a regular file; 'sensor_data' is closed when it has been read
+ * Return the number of rows inserted, or -1 if an error occurs
+ */
+long insert_sensor_from_file(DBCONN * conn, FILE * sensor_data){
+   struct stat st;
+   const unsigned char * base;
+   size_t records;
+   long result;
+   
+   if(fstat(fileno(sensor_data), &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0){
+      result = insert_sensor_from_stream(conn, sensor_data);
+      FILE_CLOSE_ERROR(fclose(sensor_data));
+      return result;
+   }
+   base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(sensor_data), 0);
+   if(base == MAP_FAILED){
+      perror("mmap of the sensor data file failed");
+      FILE_CLOSE_ERROR(fclose(sensor_data));
+      return -1;
+   }
+   madvise((void *)base, st.st_size, MADV_SEQUENTIAL);
+   records = st.st_size / SENSOR_RECORD_SIZE;
+   if(st.st_size % SENSOR_RECORD_SIZE != 0){
+      fprintf(stderr, "ignoring %ld bytes of an incomplete record at the end of the file\n", (long)(st.st_size % SENSOR_RECORD_SIZE));
+   }
+   result = insert_records(conn, base, records) == 0 ? (long)records : -1;
+   munmap((void *)base, st.st_size);
+   FILE_CLOSE_ERROR(fclose(sensor_data));
+   return result;
+}
+
+/* pipes and other streams that can't be mapped, read in chunks of IMPORT_CHUNK_RECORDS records */
+static long insert_sensor_from_stream(DBCONN * conn, FILE * sensor_data){
+   unsigned char * chunk = malloc(IMPORT_CHUNK_RECORDS * SENSOR_RECORD_SIZE);
+   size_t records;
+   long result = 0;
+   
+   assert(chunk != NULL);
+   while((records = fread(chunk, SENSOR_RECORD_SIZE, IMPORT_CHUNK_RECORDS, sensor_data)) != 0){
+      if(insert_records(conn, chunk, records) != 0){
+         result = -1;
+         break;
+      }
+      result += records;
+   }
+   if(result != -1 && ferror(sensor_data)){
+      perror("reading the sensor data file failed");
+      result = -1;
+   }
+   free(chunk);
+   return result;
+}
+
+/*
+ * Inserts 'count' packed records (id, value, timestamp without padding, as the sensor nodes write them)
+ * with the prepared insert statement, committing every gw_config.import_batch_size rows
+ */
+static int insert_records(DBCONN * conn, const unsigned char * records, size_t count){
+   sensor_id_t id;
+   sensor_value_t value;
+   sensor_ts_t ts;
+   size_t i, in_batch = 0;
+   
+   for(i = 0; i != count; i++, records += SENSOR_RECORD_SIZE){
+      if(in_batch == 0 && run_statement(conn, STMT_BEGIN) != 0)return -1;
+      memcpy(&id, records, sizeof(id));
+      memcpy(&value, records + sizeof(id), sizeof(value));
+      memcpy(&ts, records + sizeof(id) + sizeof(value), sizeof(ts));
+      if(insert_sensor(conn, id, value, ts) != 0){
+         run_statement(conn, STMT_ROLLBACK);
+         return -1;
+      }
+      if(++in_batch == (size_t)gw_config.import_batch_size){
+         if(run_statement(conn, STMT_COMMIT) != 0){
+            run_statement(conn, STMT_ROLLBACK);
+            return -1;
+         }
+         in_batch = 0;
+      }
+   }
+   if(in_batch != 0 && run_statement(conn, STMT_COMMIT) != 0){
+      run_statement(conn, STMT_ROLLBACK);
       return -1;
-   }else{
-      fprintf(stdout, "Mysqlite Records created successfully\n");
    }
-   free(sql);
-   sqlite3_finalize(stmt);
    return 0;
 }
 
 /*
- * Write an INSERT query to insert all sensor measurements available in the file 'sensor_data'
- * Return zero for success, and non-zero if an error occurs
+ * Drops the indexes of the table, so a bulk insert does not update them row by row
+ * Returns their CREATE statements for resume_indexes (an empty string if there are none), or NULL if an error occurs
  */
-int insert_sensor_from_file(DBCONN * conn, FILE * sensor_data){
+char * suspend_indexes(DBCONN * conn){
+   sqlite3_stmt * stmt;
+   char * indexes = strdup(""), * drops = strdup("BEGIN;"), * joined;
    char *zErrMsg = 0;
-   int rc;  
-   char * sql = NULL;
-   sqlite3_stmt *stmt; 
+   int rc;
    
-   sensor_id_t sensor_ID;
-   sensor_value_t Value;
-   sensor_ts_t Ts;
-   while (!feof(sensor_data)){
-    int i = fread(&sensor_ID,sizeof(uint16_t),1,sensor_data);
-
-    int j = fread(&Value,sizeof(double),1,sensor_data);
-
-    int k = fread(&Ts,sizeof(time_t),1,sensor_data);
-
-    if ( i == 1  && j == 1 && k == 1) {
-      /* Create SQL statement */
-
-      int p = asprintf(&sql, "INSERT INTO TABLE_NAME (sensor_id,sensor_value,timestamp) values (%hd, %f, %ld);", sensor_ID, Value, (long int)Ts);
-      if(p == -1){
-      fprintf(stdout, "There is an error occured on asprintf\n");
-      return -1;
-      }
-      sqlite3_prepare_v2(conn, sql, strlen(sql), &stmt, NULL);
-      /* Execute SQL statement */
-      rc = sqlite3_step(stmt);
-      if( rc != SQLITE_DONE ){
-	  fprintf(stderr, "SQL error: %s\n", zErrMsg);
-	  sqlite3_free(zErrMsg);
-	  return -1;
+   assert(indexes != NULL && drops != NULL);
+   if(sqlite3_prepare_v2(conn->db, "SELECT name, sql FROM sqlite_master WHERE type = 'index' AND tbl_name = '" TABLE "' AND sql IS NOT NULL;",
+                         -1, &stmt, NULL) != SQLITE_OK){
+      fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(conn->db));
+      free(indexes);
+      free(drops);
+      return NULL;
+   }
+   /* the schema can't change while it is being read, the indexes are dropped afterwards in one transaction */
+   while((rc = sqlite3_step(stmt)) == SQLITE_ROW){
+      ASPRINTF_ERROR(asprintf(&joined, "%s%s;", indexes, (const char *)sqlite3_column_text(stmt, 1)));
+      free(indexes);
+      indexes = joined;
+      ASPRINTF_ERROR(asprintf(&joined, "%sDROP INDEX \"%s\";", drops, (const char *)sqlite3_column_text(stmt, 0)));
+      free(drops);
+      drops = joined;
+   }
+   sqlite3_finalize(stmt);
+   if(rc == SQLITE_DONE){
+      ASPRINTF_ERROR(asprintf(&joined, "%sCOMMIT;", drops));
+      free(drops);
+      drops = joined;
+      if(sqlite3_exec(conn->db, drops, 0, 0, &zErrMsg) != SQLITE_OK){
+         fprintf(stderr, "SQL error: %s\n", zErrMsg);
+         sqlite3_free(zErrMsg);
+         sqlite3_exec(conn->db, "ROLLBACK;", 0, 0, NULL);
+         rc = SQLITE_ERROR;
       }
-  //     else{
-  // 	//fprintf(stdout, "Records created successfully\n");
-  //     }
-    }
-   else{
-       fprintf(stdout, "fread reach end of file or failed\n");
-       fclose(sensor_data);
-       break;
    }
-  }
-  free(sql);
-  sqlite3_finalize(stmt);
-  return 0;
+   else fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(conn->db));
+   free(drops);
+   if(rc != SQLITE_DONE){
+      free(indexes);
+      return NULL;
+   }
+   return indexes;
+}
+
+/*
+ * Creates the indexes returned by suspend_indexes again, and frees 'indexes'
+ * Return zero for success, and non-zero if an error occurs
+ */
+int resume_indexes(DBCONN * conn, char * indexes){
+   char *zErrMsg = 0;
+   int result = 0;
+   
+   if(indexes == NULL)return 0;
+   if(sqlite3_exec(conn->db, indexes, 0, 0, &zErrMsg) != SQLITE_OK){
+      fprintf(stderr, "SQL error: %s\n", zErrMsg);
+      sqlite3_free(zErrMsg);
+      result = -1;
+   }
+   free(indexes);
+   return result;
 }
 
 /*
@@ -262,23 +694,7 @@ int insert_sensor_from_file(DBCONN * conn, FILE * sensor_data){
   * Return zero for success, and non-zero if an error occurs
   */
 int find_sensor_all(DBCONN * conn, callback_t f){
-   char *zErrMsg = 0;
-   int rc;
-   char *sql;
-   const char* data = "Callback function called";
-   /* Create SQL statement */
-   sql = "SELECT * from TABLE_NAME";
-
-   /* Execute SQL statement */
-   rc = sqlite3_exec(conn, sql, f, (void*)data, &zErrMsg);
-   if( rc != SQLITE_OK ){
-      fprintf(stderr, "SQL error: %s\n", zErrMsg);
-      sqlite3_free(zErrMsg);
-      return -1;
-   }else{
-      fprintf(stdout, "Operation done successfully\n");
-   }
-   return 0;
+   return run_query(conn, STMT_FIND_ALL, f);
 }
 
 /*
@@ -287,28 +703,8 @@ int find_sensor_all(DBCONN * conn, callback_t f){
  * Return zero for success, and non-zero if an error occurs
  */
 int find_sensor_by_value(DBCONN * conn, sensor_value_t value, callback_t f){
-   char *zErrMsg = 0;
-   int rc;
-   char *sql;
-   const char* data = "Callback function called";
-   
-   int i = asprintf(&sql, "SELECT * from TABLE_NAME WHERE sensor_value = ( %f );", value);
-   if(i == -1){
-      fprintf(stdout, "There is an error occured on asprintf\n");
-      return -1;
-   }
-    
-   /* Execute SQL statement */
-   rc = sqlite3_exec(conn, sql, f, (void*)data, &zErrMsg);
-   if( rc != SQLITE_OK){
-      fprintf(stderr, "SQL error: %s\n", zErrMsg);
-      sqlite3_free(zErrMsg);
-      return -1;
-   }else{
-      fprintf(stdout, "Operation done successfully\n");
-   }
-   free(sql);
-   return 0;
+   sqlite3_bind_double(conn->stmt[STMT_FIND_BY_VALUE], 1, value);
+   return run_query(conn, STMT_FIND_BY_VALUE, f);
 }
 
 /*
@@ -317,28 +713,8 @@ int find_sensor_by_value(DBCONN * conn, sensor_value_t value, callback_t f){
  * Return zero for success, and non-zero if an error occurs
  */
 int find_sensor_exceed_value(DBCONN * conn, sensor_value_t value, callback_t f){
-   char *zErrMsg = 0;
-   int rc;
-   char *sql;
-   const char* data = "Callback function called";
-   /* Create SQL statement */
-   int i = asprintf(&sql, "SELECT * from TABLE_NAME WHERE sensor_value > ( %f );", value);
-   if(i == -1){
-      fprintf(stdout, "There is an error occured on asprintf\n");
-      return -1;
-   }
-
-   /* Execute SQL statement */
-   rc = sqlite3_exec(conn, sql, f, (void*)data, &zErrMsg);
-   if( rc != SQLITE_OK ){
-      fprintf(stderr, "SQL error: %s\n", zErrMsg);
-      sqlite3_free(zErrMsg);
-      return -1;
-   }else{
-      fprintf(stdout, "Operation done successfully\n");
-   }
-   free(sql);
-   return 0;
+   sqlite3_bind_double(conn->stmt[STMT_FIND_EXCEED_VALUE], 1, value);
+   return run_query(conn, STMT_FIND_EXCEED_VALUE, f);
 }
 
 /*
@@ -347,28 +723,8 @@ int find_sensor_exceed_value(DBCONN * conn, sensor_value_t value, callback_t f){
  * Return zero for success, and non-zero if an error occurs
  */
 int find_sensor_by_timestamp(DBCONN * conn, sensor_ts_t ts, callback_t f){
-   char *zErrMsg = 0;
-   int rc;
-   char *sql;
-   const char* data = "Callback function called";
-   /* Create SQL statement */
-   int i = asprintf(&sql, "SELECT * from TABLE_NAME WHERE timestamp = ( %ld );", (long int)ts);
-   if(i == -1){
-      fprintf(stdout, "There is an error occured on asprintf\n");
-      return -1;
-   }
-
-   /* Execute SQL statement */
-   rc = sqlite3_exec(conn, sql, f, (void*)data, &zErrMsg);
-   if( rc != SQLITE_OK ){
-      fprintf(stderr, "SQL error: %s\n", zErrMsg);
-      sqlite3_free(zErrMsg);
-      return -1;
-   }else{
-      fprintf(stdout, "Operation done successfully\n");
-   }
-   free(sql);
-   return 0;
+   sqlite3_bind_int64(conn->stmt[STMT_FIND_BY_TIMESTAMP], 1, ts);
+   return run_query(conn, STMT_FIND_BY_TIMESTAMP, f);
 }
 
 
@@ -378,27 +734,78 @@ int find_sensor_by_timestamp(DBCONN * conn, sensor_ts_t ts, callback_t f){
  * return zero for success, and non-zero if an error occurs
  */
 int find_sensor_after_timestamp(DBCONN * conn, sensor_ts_t ts, callback_t f){
-   char *zErrMsg = 0;
-   int rc;
-   char *sql;
-   const char* data = "Callback function called";
-  
-   /* Create SQL statement */ 
-   int i = asprintf(&sql, "SELECT * from TABLE_NAME WHERE timestamp > ( %ld );", (long int)ts);
-   if(i == -1){
-      fprintf(stdout, "There is an error occured on asprintf\n");
-      return -1;
+   sqlite3_bind_int64(conn->stmt[STMT_FIND_AFTER_TIMESTAMP], 1, ts);
+   return run_query(conn, STMT_FIND_AFTER_TIMESTAMP, f);
+}
+
+/*
+ * Starts the query 'query' on the connection, its rows are fetched with query_next
+ * Returns NULL if an error occurs, or if a query of the same kind is still open on the connection
+ */
+db_cursor_t * query_open(DBCONN * conn, const db_query_t * query){
+   const db_statement_t which = query->sensor_id == SENSOR_ANY ? STMT_QUERY_RANGE : STMT_QUERY_SENSOR;
+   sqlite3_stmt * stmt = conn->stmt[which];
+   db_cursor_t * cursor;
+   
+   if(conn->in_use[which]){
+      fprintf(stderr, "query_open: a query of this kind is still open on the connection\n");
+      return NULL;
    }
+   if(which == STMT_QUERY_SENSOR)sqlite3_bind_int(stmt, 1, query->sensor_id);
+   sqlite3_bind_int64(stmt, 2, query->from);
+   sqlite3_bind_int64(stmt, 3, query->to);
+   sqlite3_bind_int64(stmt, 4, query->limit > 0 ? query->limit : -1);     // a negative limit is none
+   sqlite3_bind_int64(stmt, 5, query->offset);
+   cursor = malloc(sizeof(db_cursor_t));
+   assert(cursor != NULL);
+   cursor->conn = conn;
+   cursor->which = which;
+   cursor->stmt = stmt;
+   conn->in_use[which] = true;
+   cursor->done = false;
+   return cursor;
+}
 
-   /* Execute SQL statement */
-   rc = sqlite3_exec(conn, sql, f, (void*)data, &zErrMsg);
-   if( rc != SQLITE_OK ){
-      fprintf(stderr, "SQL error: %s\n", zErrMsg);
-      sqlite3_free(zErrMsg);
+/*
+ * Copies the next rows of the query, at most 'max' (at least 1), into 'rows'
+ * Returns how many rows were copied, 0 once every row has been returned, or -1 if an error occurs or 'max' < 1
+ */
+int query_next(db_cursor_t * cursor, sensor_data_t * rows, int max){
+   int rc = SQLITE_ROW, count = 0;
+   
+   if(max < 1){
+      fprintf(stderr, "query_next: max must be at least 1\n");
       return -1;
-   }else{
-      fprintf(stdout, "Operation done successfully\n");
    }
-   free(sql);
-   return 0;
-}
\ No newline at end of file
+   if(cursor->done)return 0;
+   while(count != max && (rc = sqlite3_step(cursor->stmt)) == SQLITE_ROW){
+      rows[count].id = sqlite3_column_int(cursor->stmt, 0);
+      rows[count].value = sqlite3_column_double(cursor->stmt, 1);
+      rows[count].ts = sqlite3_column_int64(cursor->stmt, 2);
+      count++;
+   }
+   if(rc == SQLITE_ROW)return count;
+   /* the statement is reset right away, so a finished query does not keep its snapshot of the database */
+   cursor->done = true;
+   sqlite3_reset(cursor->stmt);
+   sqlite3_clear_bindings(cursor->stmt);
+   if(rc != SQLITE_DONE){
+      fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(cursor->conn->db));
+      return -1;
+   }
+   return count;
+}
+
+/*
+ * Ends the query, whether or not all its rows were fetched, and frees the cursor
+ */
+void query_close(db_cursor_t ** cursor){
+   if(cursor == NULL || *cursor == NULL)return;
+   if(!(*cursor)->done){
+      sqlite3_reset((*cursor)->stmt);
+      sqlite3_clear_bindings((*cursor)->stmt);
+   }
+   (*cursor)->conn->in_use[(*cursor)->which] = false;
+   free(*cursor);
+   *cursor = NULL;
+}
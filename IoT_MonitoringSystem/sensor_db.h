@@ -14,24 +14,113 @@
 #define TO_STRING(s) REAL_TO_STRING(s)    //force macro-expansion on s before stringify s
 
 #ifndef DB_NAME
-  #define DB_NAME Sensor.db
+  #define DB_NAME Sensor.db        // compile time default, the value in use is gw_config.db_name
 #endif
 
 #ifndef TABLE_NAME
   #define TABLE_NAME SensorData
 #endif
 
-#define DBCONN sqlite3 
+/*
+ * Durability profiles (gw_config.db_profile), applied whenever a connection is opened:
+ *   DB_PROFILE_LEGACY   rollback journal, synchronous FULL: readers block the writer
+ *   DB_PROFILE_SAFE       WAL, synchronous FULL: every commit survives a power loss
+ *   DB_PROFILE_NORMAL   WAL, synchronous NORMAL: a power loss may undo the last commits, never corrupts
+ *   DB_PROFILE_FAST       WAL, synchronous OFF: an OS crash may corrupt the database
+ * The WAL profiles also set the page, cache and mmap sizes below and move checkpoints to a background thread
+ */
+#ifndef DB_PROFILE
+  #define DB_PROFILE DB_PROFILE_NORMAL
+#endif
+
+#ifndef DB_PAGE_SIZE
+  #define DB_PAGE_SIZE 4096             // only takes effect when the database file is created
+#endif
+
+#ifndef DB_CACHE_KIB
+  #define DB_CACHE_KIB 8192             // page cache per connection
+#endif
+
+#ifndef DB_MMAP_SIZE
+  #define DB_MMAP_SIZE (64L << 20)     // bytes of the database read through mmap, 0 = none
+#endif
+
+#ifndef DB_CHECKPOINT_PAGES
+  #define DB_CHECKPOINT_PAGES 1000     // a commit that leaves this many pages in the WAL not yet copied wakes the checkpointer
+#endif
+
+#ifndef DB_CHECKPOINT_INTERVAL
+  #define DB_CHECKPOINT_INTERVAL 5     // seconds between checkpoints without that many pages, 0 = none
+#endif
+
+#define DB_BUSY_TIMEOUT_MS 5000
+
+#ifndef STORAGE_BATCH_SIZE
+  #define STORAGE_BATCH_SIZE 256      // most readings committed in one transaction, gw_config.storage_batch_size
+#endif
+
+#ifndef STORAGE_LINGER_MS
+  #define STORAGE_LINGER_MS 50         // how long a batch waits for more readings before it is committed, gw_config.storage_linger_ms
+#endif
+
+#ifndef IMPORT_BATCH_SIZE
+  #define IMPORT_BATCH_SIZE 100000     // rows per transaction of insert_sensor_from_file, gw_config.import_batch_size
+#endif
+
+#define IMPORT_CHUNK_RECORDS 4096                                                       // records per read of a stream that can't be mapped
+#define SENSOR_RECORD_SIZE (sizeof(sensor_id_t) + sizeof(sensor_value_t) + sizeof(sensor_ts_t))   // a record in a sensor data file
+
+/*
+ * A connection and its prepared statements, made by init_connection or retry_connection and freed by disconnect
+ */
+typedef struct dbconn dbconn_t;
+
+#define DBCONN dbconn_t
+
+/*
+ * Group commit statistics of storagemgr_parse_sensor_data, see storagemgr_get_stats
+ * Latency is measured from the first reading of a batch leaving the buffer until its commit returned
+ */
+typedef struct{
+  long                 batches;
+  long                 rows;
+  int                   last_batch;
+  int                   max_batch;
+  double             last_latency_ms;
+  double             max_latency_ms;
+  double             total_latency_ms;     // divide by batches for the mean
+  long                 checkpoints;           // by the background checkpointer
+  int                   wal_pages;            // left in the WAL by the last checkpoint, still needed by readers
+}storagemgr_stats_t;
 
 typedef int (*callback_t)(void *, int, char **, char **);
 
+#define SENSOR_ANY (-1)                    // db_query_t.sensor_id of a query over all sensors
+
+/* rows of one sensor, or of all sensors, recorded from 'from' to 'to' (inclusive), oldest first */
+typedef struct{
+  int                    sensor_id;            // or SENSOR_ANY
+  sensor_ts_t        from;
+  sensor_ts_t        to;
+  long                  offset;                // rows skipped before the first one returned
+  long                  limit;                   // most rows returned, 0 = all
+}db_query_t;
+
+typedef struct db_cursor db_cursor_t;
+
 
 /*
  * Reads continiously all data from the shared buffer data structure and stores this into the database
+ * Readings are committed in batches of up to gw_config.storage_batch_size, one transaction each
  * When *buffer becomes NULL the method finishes. This method will NOT automatically disconnect from the db
  */
 void storagemgr_parse_sensor_data(DBCONN * conn, sbuffer_t ** buffer);
 
+/*
+ * Copies the group commit statistics into '*stats', safe from any thread
+ */
+void storagemgr_get_stats(storagemgr_stats_t * stats);
+
 /*
  * Make a connection to the database server
  * Create (open) a database with name DB_NAME having 1 table named TABLE_NAME  
@@ -57,6 +146,25 @@ void disconnect(DBCONN *conn);
  */
 int insert_sensor(DBCONN * conn, sensor_id_t id, sensor_value_t value, sensor_ts_t ts);
 
+/*
+ * Insert all sensor measurements available in the file 'sensor_data', gw_config.import_batch_size rows per transaction
+ * The file is read through mmap when it is a regular file; 'sensor_data' is closed when it has been read
+ * Return the number of rows inserted, or -1 if an error occurs
+ */
+long insert_sensor_from_file(DBCONN * conn, FILE * sensor_data);
+
+/*
+ * Drops the indexes of the table, so a bulk insert does not update them row by row
+ * Returns their CREATE statements for resume_indexes (an empty string if there are none), or NULL if an error occurs
+ */
+char * suspend_indexes(DBCONN * conn);
+
+/*
+ * Creates the indexes returned by suspend_indexes again, and frees 'indexes'
+ * Return zero for success, and non-zero if an error occurs
+ */
+int resume_indexes(DBCONN * conn, char * indexes);
+
 /*
   * Write a SELECT query to select all sensor measurements in the table 
   * The callback function is applied to every row in the result
@@ -96,5 +204,23 @@ int find_sensor_by_timestamp(DBCONN * conn, sensor_ts_t ts, callback_t f);
  */
 int find_sensor_after_timestamp(DBCONN * conn, sensor_ts_t ts, callback_t f);
 
+/*
+ * Starts the query 'query' on the connection, its rows are fetched with query_next
+ * Only one query over one sensor and one over all sensors can be open on a connection at a time
+ * Returns NULL if an error occurs, or if a query of the same kind is still open on the connection
+ */
+db_cursor_t * query_open(DBCONN * conn, const db_query_t * query);
+
+/*
+ * Copies the next rows of the query, at most 'max' (at least 1), into 'rows'
+ * Returns how many rows were copied, 0 once every row has been returned, or -1 if an error occurs or 'max' < 1
+ */
+int query_next(db_cursor_t * cursor, sensor_data_t * rows, int max);
+
+/*
+ * Ends the query, whether or not all its rows were fetched, and frees the cursor
+ */
+void query_close(db_cursor_t ** cursor);
+
 #endif /* _SENSOR_DB_H_ */
 
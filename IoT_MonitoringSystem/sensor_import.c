@@ -0,0 +1,118 @@
+#define _GNU_SOURCE
+/*-----------------------------------------------------------------------------
+		include files
+------------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <assert.h>
+
+#include "errmacros.h"
+#include "config.h"
+#include "gwconfig.h"
+#include "sensor_db.h"
+
+/*------------------------------------------------------------------------------
+		function declarations
+------------------------------------------------------------------------------*/
+void       print_help               (void);
+double     seconds_since            (const struct timespec * start);
+
+/*------------------------------------------------------------------------------
+		implementation code
+------------------------------------------------------------------------------*/
+int main( int argc, char *argv[] ){
+  const char * config_file = NULL;
+  char ** overrides = calloc(argc, sizeof(char *));
+  bool defer_indexes = false;
+  char * indexes = NULL;
+  struct timespec start, file_start;
+  long rows, total = 0;
+  int opt, i, count = 0, result = 0;
+  DBCONN * conn;
+  FILE * fp;
+  assert(overrides != NULL);
+
+  while((opt = getopt(argc, argv, "c:o:dh")) != -1){
+    switch(opt){
+      case 'c':
+        config_file = optarg;
+        break;
+      case 'o':
+        overrides[count++] = optarg;
+        break;
+      case 'd':
+        defer_indexes = true;
+        break;
+      default:
+        print_help();
+        exit(EXIT_SUCCESS);
+    }
+  }
+  if(optind == argc){
+    print_help();
+    exit(EXIT_FAILURE);
+  }
+  if(config_file != NULL && gwconfig_load(config_file) == -1)result = -1;
+  for(i = 0; i != count; i++){
+    if(gwconfig_override(overrides[i]) == -1)result = -1;
+  }
+  free(overrides);
+  if(result == -1 || gwconfig_validate() == -1)exit(EXIT_FAILURE);
+
+  conn = init_connection(0);
+  if(conn == NULL){
+    fprintf(stderr, "Can't open database %s\n", gw_config.db_name);
+    exit(EXIT_FAILURE);
+  }
+  if(defer_indexes){
+    indexes = suspend_indexes(conn);
+    if(indexes == NULL){
+      disconnect(conn);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(i = optind; i != argc; i++){
+    fp = fopen(argv[i], "r");
+    if(fp == NULL){
+      perror(argv[i]);
+      result = -1;
+      continue;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &file_start);
+    rows = insert_sensor_from_file(conn, fp);
+    if(rows == -1){
+      fprintf(stderr, "%s: import failed, rows of unfinished transactions were rolled back\n", argv[i]);
+      result = -1;
+      continue;
+    }
+    printf("%s: %ld rows in %.2f s\n", argv[i], rows, seconds_since(&file_start));
+    total += rows;
+  }
+  if(defer_indexes){
+    clock_gettime(CLOCK_MONOTONIC, &file_start);
+    if(resume_indexes(conn, indexes) != 0)result = -1;
+    else printf("indexes rebuilt in %.2f s\n", seconds_since(&file_start));
+  }
+  printf("%ld rows imported into %s in %.2f s, %.0f rows/s\n", total, gw_config.db_name, seconds_since(&start),
+         total / seconds_since(&start));
+  disconnect(conn);
+  return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+double seconds_since(const struct timespec * start){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void print_help(void)
+{
+  printf("Use this program to backfill the sensor database from sensor data files: sensor_import [-c gateway.conf] [-o key=value ...] [-d] <sensor_data> ...\n");
+  printf("\tdb_name, db_profile and import_batch_size are read like the gateway reads them\n");
+  printf("\t-d drops the indexes of the table before the import and rebuilds them once at the end\n");
+}
@@ -0,0 +1,95 @@
+#define _GNU_SOURCE
+/*-----------------------------------------------------------------------------
+		include files
+------------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "timerwheel.h"
+
+/*------------------------------------------------------------------------------
+		definitions (defines, typedefs, ...)
+------------------------------------------------------------------------------*/
+#define SLOT_MASK   (TIMER_WHEEL_SLOTS - 1)
+#define NO_TIMER    0                 // list links are timer numbers + 1
+
+typedef struct{
+  time_t               due;
+  uint32_t            next;          // next timer in the same slot
+  bool                  armed;
+}wheel_timer_t;
+
+struct timer_wheel{
+  time_t               now;            // every slot up to and including this second has been processed
+  uint32_t            count;
+  wheel_timer_t *   timers;
+  uint32_t            slots[TIMER_WHEEL_SLOTS];
+};
+
+/*------------------------------------------------------------------------------
+		implementation code
+------------------------------------------------------------------------------*/
+timer_wheel_t * timer_wheel_create(uint32_t timers, time_t now){
+  timer_wheel_t * wheel = calloc(1, sizeof(timer_wheel_t));
+  assert(wheel != NULL);
+  wheel->timers = calloc(timers + 1, sizeof(wheel_timer_t));
+  assert(wheel->timers != NULL);
+  wheel->count = timers;
+  wheel->now = now;
+  return wheel;
+}
+
+bool timer_wheel_arm(timer_wheel_t * wheel, uint32_t timer, time_t due){
+  wheel_timer_t * t = &wheel->timers[timer];
+  assert(timer < wheel->count);
+  if(t->armed)return false;
+  if(due <= wheel->now)due = wheel->now + 1;
+  t->due = due;
+  t->armed = true;
+  t->next = wheel->slots[due & SLOT_MASK];
+  wheel->slots[due & SLOT_MASK] = timer + 1;
+  return true;
+}
+
+bool timer_wheel_armed(const timer_wheel_t * wheel, uint32_t timer){
+  return wheel->timers[timer].armed;
+}
+
+void timer_wheel_advance(timer_wheel_t * wheel, time_t now, timer_expire_t expire, void * ctx){
+  const time_t from = wheel->now;
+  /* after a long stall every slot is visited once, everything due by 'now' expires in that pass */
+  const time_t ticks = now - from > TIMER_WHEEL_SLOTS ? TIMER_WHEEL_SLOTS : now - from;
+  time_t k;
+
+  for(k = 1; k <= ticks; k++){
+    const uint32_t slot = (from + k) & SLOT_MASK;
+    const time_t limit = ticks == TIMER_WHEEL_SLOTS ? now : from + k;
+    uint32_t next = wheel->slots[slot];
+    wheel->slots[slot] = NO_TIMER;
+    wheel->now = limit;
+    while(next != NO_TIMER){
+      const uint32_t timer = next - 1;
+      wheel_timer_t * t = &wheel->timers[timer];
+      next = t->next;
+      if(t->due > limit){
+        /* due in a later round of the wheel */
+        t->next = wheel->slots[slot];
+        wheel->slots[slot] = timer + 1;
+      }
+      else{
+        t->armed = false;
+        expire(ctx, timer, limit);
+      }
+    }
+  }
+  if(now > wheel->now)wheel->now = now;
+}
+
+void timer_wheel_free(timer_wheel_t ** wheel){
+  if(wheel == NULL || *wheel == NULL)return;
+  free((*wheel)->timers);
+  free(*wheel);
+  *wheel = NULL;
+}
@@ -0,0 +1,50 @@
+#ifndef _TIMERWHEEL_H_
+#define _TIMERWHEEL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#ifndef TIMER_WHEEL_SLOTS
+  #define TIMER_WHEEL_SLOTS 1024        // one slot per second, a power of 2; later timers go around the wheel again
+#endif
+
+/*
+ * Hashed timer wheel with a resolution of one second for a fixed set of timers numbered 0 .. timers - 1
+ * Arming and expiring a timer are O(1), advancing the wheel costs one slot per second plus the timers in it
+ * Not thread safe: one wheel belongs to one thread
+ */
+typedef struct timer_wheel timer_wheel_t;
+
+/*
+ * Called for every timer that is due, the timer is disarmed before the call and may be armed again
+ */
+typedef void (*timer_expire_t)(void * ctx, uint32_t timer, time_t now);
+
+/*
+ * Returns a wheel for 'timers' timers, all disarmed, with the current time 'now'
+ */
+timer_wheel_t * timer_wheel_create(uint32_t timers, time_t now);
+
+/*
+ * Arms 'timer' to expire at 'due' (at the next advance if 'due' has passed)
+ * Returns false, without changing anything, if the timer is already armed
+ */
+bool timer_wheel_arm(timer_wheel_t * wheel, uint32_t timer, time_t due);
+
+/*
+ * Returns true if 'timer' is armed
+ */
+bool timer_wheel_armed(const timer_wheel_t * wheel, uint32_t timer);
+
+/*
+ * Moves the wheel to time 'now', calling 'expire' for every timer that is due at or before 'now'
+ */
+void timer_wheel_advance(timer_wheel_t * wheel, time_t now, timer_expire_t expire, void * ctx);
+
+/*
+ * Frees the wheel
+ */
+void timer_wheel_free(timer_wheel_t ** wheel);
+
+#endif /* _TIMERWHEEL_H_ */